@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+
+// Bump allocator for data that lives as long as the compilation and never grows: the interned text
+// of identifiers and literals, which is all that is kept of a streamed source. Allocations are
+// carved out of large chunks and released all at once by arena_free. The AST pools and the maps
+// grow by reallocating, which an arena can't do without leaking every outgrown copy.
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct {
+    ArenaChunk *head;
+    size_t chunks;
+    size_t allocs;
+} Arena;
+
+// Counts every call the compiler makes into the system allocator
+typedef struct {
+    size_t mallocs;
+    size_t bytes;
+} AllocStats;
+
+extern Arena arena;
+extern AllocStats alloc_stats;
+
+void *arena_alloc(Arena *, size_t size, size_t align);
+void *arena_copy(Arena *, const void *, size_t);
+void arena_free(Arena *);
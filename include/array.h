@@ -1,42 +1,83 @@
 #pragma once
 
-#define ARRAY_CAP 128
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARRAY_CAP 8
 #define ARRAY_MUL 2
 
+// Grow a dynamic array's backing storage so it can hold at least `want` items. The capacity is
+// grown geometrically so a run of appends reallocates O(log n) times.
+static inline void *array_grow(void *items, size_t *cap, size_t want, size_t size) {
+    size_t ncap = *cap == 0 ? ARRAY_CAP : *cap;
+    while (ncap < want) {
+        ncap *= ARRAY_MUL;
+    }
+
+    void *ptr = realloc(items, ncap * size);
+    if (ptr == nullptr) {
+        fprintf(stderr, "realloc failed\n");
+        exit(1);
+    }
+    alloc_stats.mallocs++;
+    alloc_stats.bytes += ncap * size;
+
+    *cap = ncap;
+    return ptr;
+}
+
+// Ensure there is room for at least `n` more items without reallocating
+#define reserve(array, n)                                                                          \
+    ({                                                                                             \
+        size_t reserve_want = (array)->len + (n);                                                  \
+        if (reserve_want > (array)->cap) {                                                         \
+            (array)->items = array_grow((array)->items, &(array)->cap, reserve_want,               \
+                                        sizeof((array)->items[0]));                                \
+        }                                                                                          \
+    })
+
 #define append(array, item)                                                                        \
-    if ((array)->cap == 0) {                                                                       \
-        (array)->cap = ARRAY_CAP;                                                                  \
-    }                                                                                              \
-    if ((array)->len == (array)->cap) {                                                            \
-        (array)->cap *= ARRAY_MUL;                                                                 \
-    }                                                                                              \
-    (array)->items = realloc((array)->items, (array)->cap * sizeof((array)->items[0]));            \
-    (array)->items[(array)->len++] = item;
-
-#define peek(iter)                                                                                 \
     ({                                                                                             \
-        auto value = &(iter)->array.items[0];                                                      \
-        if ((iter)->position >= (iter)->array.len) {                                               \
-            value = nullptr;                                                                       \
-        } else {                                                                                   \
-            value = &(iter)->array.items[(iter)->position];                                        \
+        if ((array)->len == (array)->cap) {                                                        \
+            reserve(array, 1);                                                                     \
         }                                                                                          \
-        value;                                                                                     \
+        (array)->items[(array)->len++] = item;                                                     \
+    })
+
+// Append `n` items copied from `src`
+#define append_n(array, src, n)                                                                    \
+    ({                                                                                             \
+        size_t append_count = (n);                                                                 \
+        reserve(array, append_count);                                                              \
+        memcpy(&(array)->items[(array)->len], (src), append_count * sizeof((array)->items[0]));    \
+        (array)->len += append_count;                                                              \
     })
 
-#define next(iter)                                                                                 \
+// Release any capacity beyond `len`
+#define shrink_to_fit(array)                                                                       \
     ({                                                                                             \
-        auto value = &(iter)->array.items[0];                                                      \
-        if ((iter)->position >= (iter)->array.len) {                                               \
-            value = nullptr;                                                                       \
-        } else {                                                                                   \
-            value = &(iter)->array.items[(iter)->position++];                                      \
+        if ((array)->len == 0) {                                                                   \
+            arrayfree(array);                                                                      \
+        } else if ((array)->len < (array)->cap) {                                                  \
+            auto shrunk = realloc((array)->items, (array)->len * sizeof((array)->items[0]));       \
+            if (shrunk == nullptr) {                                                               \
+                fprintf(stderr, "realloc failed\n");                                               \
+                exit(1);                                                                           \
+            }                                                                                      \
+            (array)->items = shrunk;                                                               \
+            (array)->cap = (array)->len;                                                           \
         }                                                                                          \
-        value;                                                                                     \
     })
 
 #define arrayfree(array)                                                                           \
-    if ((array)->items != nullptr) {                                                               \
-        free((array)->items);                                                                      \
-        (array)->items = nullptr;                                                                  \
-    }\
+    ({                                                                                             \
+        if ((array)->items != nullptr) {                                                           \
+            free((array)->items);                                                                  \
+            (array)->items = nullptr;                                                              \
+        }                                                                                          \
+        (array)->len = 0;                                                                          \
+        (array)->cap = 0;                                                                          \
+    })
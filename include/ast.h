@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+
+#include "intern.h"
 #include "str.h"
 
 // program -> functions
@@ -25,13 +28,13 @@
 //         | value
 
 typedef struct {
-    String name;
+    Atom name;
     bool pointer;
 } Type;
 
 typedef struct {
     Type type;
-    String name;
+    Atom name;
 } Declaration;
 
 typedef struct {
@@ -42,6 +45,25 @@ typedef struct {
 
 /* Expressions */
 
+// Expressions and statements live in pools owned by the Program and refer to each other by 32-bit
+// index rather than by pointer, so a whole function body is a few contiguous arrays.
+typedef uint32_t ExprId;
+typedef uint32_t StmtId;
+
+#define NO_EXPR UINT32_MAX
+
+// A run of expression ids in Program.lists, used for call arguments
+typedef struct {
+    uint32_t start;
+    uint32_t len;
+} ExprList;
+
+// A run of consecutive statements in Program.stmts
+typedef struct {
+    StmtId start;
+    uint32_t len;
+} Block;
+
 typedef enum { E_BINARY_OP, E_VALUE, E_IDENT, E_CALL } ExprKind;
 typedef struct Expr Expr;
 
@@ -51,6 +73,12 @@ typedef struct {
     Expr *items;
 } Exprs;
 
+typedef struct {
+    size_t len;
+    size_t cap;
+    ExprId *items;
+} ExprIds;
+
 typedef enum {
     OP_ADD,
     OP_SUB,
@@ -66,14 +94,14 @@ typedef enum {
     OP_LOR
 } BinaryOp;
 typedef struct {
-    Expr *left;
+    ExprId left;
     BinaryOp op;
-    Expr *right;
+    ExprId right;
 } BinaryOpExpr;
 
 typedef union {
-    String str;
-    String ch;
+    StringView str;
+    StringView ch;
     long num;
 } Value;
 
@@ -84,12 +112,12 @@ typedef struct {
 } ValueExpr;
 
 typedef struct {
-    String name;
+    Atom name;
 } IdentExpr;
 
 typedef struct {
-    String name;
-    Exprs args;
+    Atom name;
+    ExprList args;
 } CallExpr;
 
 typedef union {
@@ -117,30 +145,30 @@ typedef struct {
 
 typedef struct {
     Declaration decl;
-    Expr expr;
+    ExprId expr;
 } DefinitionStatement;
 
 typedef struct {
-    String name;
-    Expr expr;
+    Atom name;
+    ExprId expr;
 } AssignStatement;
 
 typedef struct {
-    Expr expr;
+    ExprId expr;
 } ExprStatement;
 
 typedef struct {
-    Expr expr;
-    Statements stmts;
+    ExprId expr;
+    Block stmts;
 } IfStatement;
 
 typedef struct {
-    Expr expr;
-    Statements stmts;
+    ExprId expr;
+    Block stmts;
 } WhileStatement;
 
 typedef struct {
-    Expr *expr;
+    ExprId expr; // NO_EXPR for a bare return
 } ReturnStatement;
 
 typedef union {
@@ -162,7 +190,7 @@ struct Statement {
 typedef struct {
     Declaration decl;
     Declarations args;
-    Statements stmts;
+    Block stmts;
 } Function;
 
 typedef struct {
@@ -175,4 +203,19 @@ typedef struct {
 
 typedef struct {
     Functions funcs;
+    Exprs exprs;
+    Statements stmts;
+    ExprIds lists;
 } Program;
+
+static inline Expr *expr_at(const Program *prg, ExprId id) {
+    return &prg->exprs.items[id];
+}
+
+static inline Statement *stmt_at(const Program *prg, const Block *block, size_t i) {
+    return &prg->stmts.items[block->start + i];
+}
+
+static inline ExprId list_at(const Program *prg, const ExprList *list, size_t i) {
+    return prg->lists.items[list->start + i];
+}
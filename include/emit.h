@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "intern.h"
+#include "str.h"
+
+#define EMIT_BUF 65536
+
+// Generated code is assembled in a fixed buffer and written out a buffer at a time, so emitting an
+// instruction costs a few memcpys rather than a formatted, locked stdio call.
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[EMIT_BUF];
+} Emitter;
+
+extern Emitter out;
+
+void emit_open(Emitter *, const char *path);
+void emit_flush(Emitter *);
+void emit_close(Emitter *);
+
+void emit_bytes(Emitter *, const char *, size_t);
+void emit_str(Emitter *, const char *);
+void emit_view(Emitter *, const StringView *);
+void emit_atom(Emitter *, Atom);
+void emit_char(Emitter *, char);
+void emit_long(Emitter *, long);
@@ -1,6 +1,7 @@
 #include <stdio.h>
 
 #include "ast.h"
+#include "ir.h"
 
 typedef enum { Void, Byte, Char, Int, Long, Record } TypeKind;
 typedef struct {
@@ -32,6 +33,7 @@ TypeInfo char_ptr_type = {
 TypeInfo byte_type = {.kind = Byte, .slotsize = 1, .retext = ".w", .opext = ".b"};
 
 void gen_program(const Program *);
+void gen_check(const Program *);
 
 void gen_function(const Function *);
 
@@ -43,12 +45,14 @@ void gen_if_statement(const TypeInfo *, const IfStatement *);
 void gen_while_statement(const TypeInfo *, const WhileStatement *);
 void gen_return_statement(const TypeInfo *, const ReturnStatement *);
 
-void gen_expr(ExprContext *, const Expr *);
+void gen_branch(ExprId, bool, int);
+
+void gen_expr(ExprContext *, ExprId);
 void gen_value_expr(ExprContext *, const ValueExpr *);
 void gen_binary_op_expr(ExprContext *, const BinaryOpExpr *exp);
 void gen_ident_expr(ExprContext *, const IdentExpr *);
 void gen_call_expr(ExprContext *, const CallExpr *);
 
 void gen_op(const char *, BinaryOp);
-void gen_cmp_op(const char *, const char *);
-void gen_logical_op(const char *, int);
+void gen_cmp_op(const char *, JumpCond);
+void gen_logical_expr(ExprContext *, const BinaryOpExpr *);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "str.h"
+
+// Every distinct identifier is mapped to a small integer once, at lex time, so names are compared
+// by value from then on. Keywords and builtin type names are interned first, in this order, so
+// their atoms are constants.
+typedef uint32_t Atom;
+
+enum {
+    A_NONE, // Never returned by intern
+
+    // Keywords
+    A_IF,
+    A_ELSE,
+    A_WHILE,
+    A_FOR,
+    A_RETURN,
+    A_NULL,
+
+    // Builtin types
+    A_VOID,
+    A_BYTE,
+    A_CHAR,
+    A_INT,
+    A_LONG,
+
+    A_BUILTINS,
+};
+
+#define is_keyword(atom) ((atom) >= A_IF && (atom) <= A_NULL)
+
+// Expands to the length and pointer arguments of a "%.*s" conversion of an atom's text
+#define atom_fmt(atom) (int)atom_view(atom).len, atom_view(atom).items
+
+Atom intern(const StringView *);
+StringView atom_view(Atom);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "emit.h"
+#include "intern.h"
+#include "str.h"
+
+// Instructions of the target stack machine, one per line of its assembly
+typedef enum {
+    I_PUSH,      // push<ext> arg
+    I_PUSH_CHAR, // push<ext> 'text'
+    I_LOAD,      // load<ext> arg
+    I_STORE,     // store<ext> arg
+    I_DUP,       // dup<ext>
+    I_POP,       // pop<ext>
+    I_ADD,
+    I_SUB,
+    I_MUL,
+    I_DIV,
+    I_CMP,
+    I_JMP,     // jmp[.cond] l<arg>
+    I_LABEL,   // l<arg>:
+    I_CALL,    // call name
+    I_TAIL,    // jmp name, a call that reuses the current frame
+    I_RET,     // ret<ext>
+    I_FUNC,    // name:
+    I_DATA,    // .data s<arg> .string "text"
+    I_DATAPTR, // dataptr s<arg>
+} Opcode;
+
+typedef enum { J_ALWAYS, J_EQ, J_NE, J_LT, J_LE, J_GT, J_GE } JumpCond;
+
+JumpCond jump_invert(JumpCond);
+
+typedef struct {
+    Opcode op;
+    JumpCond cond;
+    const char *ext; // Type extension, "" for none
+    long arg;        // Constant, slot, label or data number
+    Atom name;
+    StringView text;
+} Instr;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    Instr *items;
+} Instrs;
+
+// Peephole rewrites, each can be switched off on its own
+typedef enum {
+    P_STORE_LOAD,  // store N; load N       -> dup; store N
+    P_IDENTITY,    // push 0; add|sub, push 1; mul|div -> nothing
+    P_JMP_NEXT,    // jmp lN; lN:           -> lN:, cmp; jmp.cc lN; lN: -> pop; pop; lN:
+    P_UNREACHABLE, // instructions after jmp or ret, up to the next label
+    P_PUSH_POP,    // push|load|dup; pop    -> nothing
+    P_THREAD,      // jumps to a jmp go to its target, jmp.cc lN; jmp lM; lN: -> jmp.!cc lM; lN:
+    P_DEAD_LABEL,  // labels nothing jumps to
+    P_DEAD_STORE,  // store N with no load of N in the function -> pop
+    P_COUNT,
+} Peephole;
+
+typedef struct {
+    bool enabled[P_COUNT];
+    size_t hits[P_COUNT];
+} PeepholeConfig;
+
+extern PeepholeConfig peephole;
+extern const char *peephole_names[P_COUNT];
+
+bool peephole_parse(const char *);
+void peephole_run(Instrs *);
+void peephole_report(void);
+
+void ir_emit(Emitter *, const Instrs *);
@@ -1,75 +1,242 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "array.h"
+#include "arena.h"
 #include "str.h"
 
-// djb2 - http://www.cse.yorku.ca/~oz/hash.html
-size_t hash(const String *s) {
-    unsigned long hash = 5381;
+// Open addressing hash map with Robin Hood probing. A map is any struct with the fields
+//
+//     size_t len;
+//     size_t cap;
+//     uint32_t generation;
+//     MapSlot *slots;
+//     T *items;
+//
+// where T has an integer `key` field, usually an Atom. items and slots are parallel arrays of cap
+// entries, cap is always a power of two.
+//
+// A slot holds a live entry only while its generation matches the map's, so clear just bumps the
+// map's generation. Deletion shifts the following run of displaced entries back one slot instead of
+// leaving a tombstone.
 
-    for (size_t i = 0; i < s->len; i++) {
-        hash = ((hash << 5) + hash) + s->items[i]; /* hash * 33 + c */
+#define MAP_CAP 16
+
+// Grow once len would exceed 7/8 of cap
+#define MAP_LOAD_NUM 7
+#define MAP_LOAD_DEN 8
+
+typedef struct {
+    uint32_t generation;
+    uint32_t dist; // Probe distance from the key's home slot
+} MapSlot;
+
+// Finalizer from MurmurHash3
+static inline size_t hash_int(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+
+    return k;
+}
+
+// Mixes the input a word at a time rather than a byte at a time
+static inline size_t hash_bytes(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+
+    for (; len >= sizeof(uint64_t); p += sizeof(uint64_t), len -= sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        h = (h ^ w) * 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 29;
+    }
+
+    if (len > 0) {
+        uint64_t w = 0;
+        for (size_t i = 0; i < len; i++) {
+            w |= (uint64_t)p[i] << (i * 8);
+        }
+        h = (h ^ w) * 0xbf58476d1ce4e5b9ULL;
     }
 
-    return hash;
+    return hash_int(h);
 }
 
-#define insert(map, item)                                                                          \
+static inline size_t hash_string(const StringView *s) {
+    return hash_bytes(s->items, s->len);
+}
+
+static inline void *map_alloc(size_t n, size_t size) {
+    void *ptr = calloc(n, size);
+    if (ptr == nullptr) {
+        fprintf(stderr, "calloc failed\n");
+        exit(1);
+    }
+    alloc_stats.mallocs++;
+    alloc_stats.bytes += n * size;
+
+    return ptr;
+}
+
+// Place an entry, swapping it with any entry that sits closer to its home slot than the one being
+// carried. Assumes there is a free slot.
+#define map_place(map, item)                                                                       \
     ({                                                                                             \
-        if ((map)->cap == 0) {                                                                     \
-            (map)->cap = 128;                                                                      \
-            (map)->items = calloc((map)->cap, sizeof((map)->items[0]));                            \
-        }                                                                                          \
+        auto entry = (item);                                                                       \
+        uint32_t dist = 0;                                                                         \
+        size_t mask = (map)->cap - 1;                                                              \
+        size_t pos = hash_int(entry.key) & mask;                                                   \
                                                                                                    \
-        size_t i = hash(&item.key) % 128;                                                          \
-        auto bucket = &(map)->items[i];                                                            \
+        while (true) {                                                                             \
+            MapSlot *slot = &(map)->slots[pos];                                                    \
+            if (slot->generation != (map)->generation) {                                           \
+                slot->generation = (map)->generation;                                              \
+                slot->dist = dist;                                                                 \
+                (map)->items[pos] = entry;                                                         \
+                (map)->len++;                                                                      \
+                break;                                                                             \
+            }                                                                                      \
                                                                                                    \
-        bool found = false;                                                                        \
-        for (size_t i = 0; i < bucket->len; i++) {                                                 \
-            if (stringcmp(&bucket->items[i].key, &item.key) == 0) {                                \
-                bucket->items[i] = item;                                                           \
-                found = true;                                                                      \
+            if ((map)->items[pos].key == entry.key) {                                              \
+                (map)->items[pos] = entry;                                                         \
                 break;                                                                             \
             }                                                                                      \
+                                                                                                   \
+            if (slot->dist < dist) {                                                               \
+                auto displaced = (map)->items[pos];                                                \
+                uint32_t displaced_dist = slot->dist;                                              \
+                (map)->items[pos] = entry;                                                         \
+                slot->dist = dist;                                                                 \
+                entry = displaced;                                                                 \
+                dist = displaced_dist;                                                             \
+            }                                                                                      \
+                                                                                                   \
+            pos = (pos + 1) & mask;                                                                \
+            dist++;                                                                                \
+        }                                                                                          \
+    })
+
+#define map_grow(map)                                                                              \
+    ({                                                                                             \
+        size_t oldcap = (map)->cap;                                                                \
+        auto olditems = (map)->items;                                                              \
+        MapSlot *oldslots = (map)->slots;                                                          \
+                                                                                                   \
+        (map)->cap = oldcap == 0 ? MAP_CAP : oldcap * 2;                                           \
+        (map)->items = map_alloc((map)->cap, sizeof((map)->items[0]));                             \
+        (map)->slots = map_alloc((map)->cap, sizeof(MapSlot));                                     \
+        (map)->len = 0;                                                                            \
+        if ((map)->generation == 0) {                                                              \
+            (map)->generation = 1;                                                                 \
         }                                                                                          \
                                                                                                    \
-        if (!found) {                                                                              \
-            append(bucket, item);                                                                  \
+        for (size_t i = 0; i < oldcap; i++) {                                                      \
+            if (oldslots[i].generation == (map)->generation) {                                     \
+                map_place(map, olditems[i]);                                                       \
+            }                                                                                      \
         }                                                                                          \
+                                                                                                   \
+        free(olditems);                                                                            \
+        free(oldslots);                                                                            \
     })
 
-#define get(map, search)                                                                           \
+// Insert an entry, replacing any entry with the same key
+#define insert(map, item)                                                                          \
     ({                                                                                             \
-        typeof((map)->items[0].items[0]) *value = nullptr;                                         \
+        if (((map)->len + 1) * MAP_LOAD_DEN > (map)->cap * MAP_LOAD_NUM) {                         \
+            map_grow(map);                                                                         \
+        }                                                                                          \
+                                                                                                   \
+        map_place(map, item);                                                                      \
+    })
+
+// Find the slot holding `search`, or cap if it is missing. Probing stops early at a slot whose
+// entry is closer to home than the search has travelled, since the key would have displaced it.
+#define map_find(map, search)                                                                      \
+    ({                                                                                             \
+        size_t found = (map)->cap;                                                                 \
+                                                                                                   \
+        if ((map)->cap != 0) {                                                                     \
+            size_t mask = (map)->cap - 1;                                                          \
+            size_t pos = hash_int(search) & mask;                                                  \
                                                                                                    \
-        if ((map)->cap == 0) {                                                                     \
-            value = nullptr;                                                                       \
-        } else {                                                                                   \
-            size_t i = hash(search) % 128;                                                         \
-            auto bucket = &(map)->items[i];                                                        \
+            for (uint32_t dist = 0;; pos = (pos + 1) & mask, dist++) {                             \
+                MapSlot *slot = &(map)->slots[pos];                                                \
+                if (slot->generation != (map)->generation || slot->dist < dist) {                  \
+                    break;                                                                         \
+                }                                                                                  \
                                                                                                    \
-            for (size_t i = 0; i < bucket->len; i++) {                                             \
-                if (stringcmp(&bucket->items[i].key, search) == 0) {                               \
-                    value = &bucket->items[i];                                                     \
+                if ((map)->items[pos].key == (search)) {                                           \
+                    found = pos;                                                                   \
+                    break;                                                                         \
                 }                                                                                  \
             }                                                                                      \
         }                                                                                          \
                                                                                                    \
+        found;                                                                                     \
+    })
+
+// Pointers into the map are invalidated by the next insert
+#define get(map, search)                                                                           \
+    ({                                                                                             \
+        typeof((map)->items[0]) *value = nullptr;                                                  \
+                                                                                                   \
+        size_t pos = map_find(map, search);                                                        \
+        if (pos != (map)->cap) {                                                                   \
+            value = &(map)->items[pos];                                                            \
+        }                                                                                          \
+                                                                                                   \
         value;                                                                                     \
     })
 
+#define erase(map, search)                                                                         \
+    ({                                                                                             \
+        size_t pos = map_find(map, search);                                                        \
+        bool erased = pos != (map)->cap;                                                           \
+                                                                                                   \
+        if (erased) {                                                                              \
+            size_t mask = (map)->cap - 1;                                                          \
+            size_t next = (pos + 1) & mask;                                                        \
+            while ((map)->slots[next].generation == (map)->generation &&                           \
+                   (map)->slots[next].dist > 0) {                                                  \
+                (map)->items[pos] = (map)->items[next];                                            \
+                (map)->slots[pos].dist = (map)->slots[next].dist - 1;                              \
+                pos = next;                                                                        \
+                next = (next + 1) & mask;                                                          \
+            }                                                                                      \
+                                                                                                   \
+            (map)->slots[pos].generation = 0;                                                      \
+            (map)->len--;                                                                          \
+        }                                                                                          \
+                                                                                                   \
+        erased;                                                                                    \
+    })
+
+// Constant time: every slot written under the old generation reads as empty afterwards. On the rare
+// wraparound the slots are wiped so stale generations can't come back to life.
 #define clear(map)                                                                                 \
-    for (size_t i = 0; i < (map)->cap; i++) {                                                      \
-        (map)->items[i].len = 0;                                                                   \
-    }
+    ({                                                                                             \
+        (map)->len = 0;                                                                            \
+        if (++(map)->generation == 0) {                                                            \
+            if ((map)->slots != nullptr) {                                                         \
+                memset((map)->slots, 0, (map)->cap * sizeof(MapSlot));                             \
+            }                                                                                      \
+            (map)->generation = 1;                                                                 \
+        }                                                                                          \
+    })
 
 #define mapfree(map)                                                                               \
-    if ((map)->cap != 0) {                                                                         \
-        for (size_t i = 0; i < (map)->cap; i++) {                                                  \
-            arrayfree((map)->items[i]);                                                            \
-        }                                                                                          \
-        free((map)->items));                                                                       \
+    ({                                                                                             \
+        free((map)->items);                                                                        \
+        free((map)->slots);                                                                        \
         (map)->items = nullptr;                                                                    \
-    }\
+        (map)->slots = nullptr;                                                                    \
+        (map)->len = 0;                                                                            \
+        (map)->cap = 0;                                                                            \
+    })
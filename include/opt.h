@@ -0,0 +1,30 @@
+#pragma once
+
+#include "ast.h"
+
+// Calls to functions whose body costs at most threshold are inlined, 0 turns inlining off
+typedef struct {
+    size_t threshold;
+    size_t sites; // Call sites inlined so far
+} InlineConfig;
+
+extern InlineConfig inlining;
+
+// Functions called often enough with the same constant argument are cloned with the constant
+// substituted, up to budget clones
+typedef struct {
+    size_t budget;
+    size_t clones; // Clones made so far
+} CloneConfig;
+
+extern CloneConfig cloning;
+
+// Passes that rewrite the program's pools in place between parsing and code generation
+void opt_program(Program *);
+
+void resolve_scopes(Program *, Function *);
+void fold_function(Program *, Function *);
+void propagate_function(Program *, Function *);
+bool evaluate_function(Program *, Function *);
+void eliminate_dead_stores(Program *, Function *);
+bool inline_function(Program *, Function *);
@@ -4,19 +4,19 @@
 #include "token.h"
 
 Program parse_program(TokenIter *);
-Function parse_function(TokenIter *);
-Functions parse_functions(TokenIter *);
-Statement parse_statement(TokenIter *, bool *);
-Statements parse_statements(TokenIter *);
+Function parse_function(Program *, TokenIter *);
+Functions parse_functions(Program *, TokenIter *);
+Statement parse_statement(Program *, TokenIter *, bool *);
+Block parse_statements(Program *, TokenIter *);
 Type parse_type(TokenIter *);
 Declaration parse_declaration(TokenIter *);
 
-Expr parse_expr(TokenIter *, int);
-Expr parse_prefix(TokenIter *);
+ExprId parse_expr(Program *, TokenIter *, int);
+ExprId parse_prefix(Program *, TokenIter *);
 int next_prec(BinaryOp);
 
-Expr binop(Expr, BinaryOp, Expr);
+ExprId binop(Program *, ExprId, BinaryOp, ExprId);
 
-void print_expr(const Expr *);
-void print_statement(const Statement *, int);
-void print_statements(const Statements *, int);
+void print_expr(const Program *, ExprId);
+void print_statement(const Program *, const Statement *, int);
+void print_statements(const Program *, const Block *, int);
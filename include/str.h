@@ -8,11 +8,18 @@ typedef struct {
     char *items;
 } String;
 
+// A non-owning view of bytes held elsewhere, usually a slice of the source buffer
 typedef struct {
-    String array;
-    size_t position;
-} CharIter;
+    size_t len;
+    const char *items;
+} StringView;
 
+// A file is mapped read-only when possible, in which case the String doesn't own heap memory and
+// cap is 0. Either way it must be released with string_close.
 String string_from_file(int);
+void string_close(String *);
 String string_from_cstr(char *);
-int stringcmp(const String *s, const String *t);
+StringView string_view(const String *, size_t, size_t);
+int stringcmp(const StringView *s, const StringView *t);
+int stringcmp_cstr(const StringView *s, const char *t);
+long stringtol(const StringView *);
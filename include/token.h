@@ -1,7 +1,9 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "intern.h"
 #include "str.h"
 
 typedef enum {
@@ -39,31 +41,73 @@ typedef enum {
     T_EOF,
 } TokenKind;
 
-typedef struct {
-    size_t line;
-} Position;
-
+// A single token, unpacked from a Tokens stream. The text of identifiers, keywords and literals is
+// interned, so it outlives the source. offset is the token's position in the input, from which
+// lexer_line recovers the line number when a diagnostic needs it.
 typedef struct {
     TokenKind kind;
-    String value;
-    Position pos;
+    Atom atom; // A_NONE for symbols
+    uint32_t offset;
 } Token;
 
 typedef struct {
     size_t len;
     size_t cap;
-    Token *items;
+    uint32_t *items;
+} Lines;
+
+// Tokens are stored as parallel arrays, 9 bytes a token. The parser mostly looks at kinds alone.
+typedef struct {
+    size_t len;
+    size_t cap;
+    uint8_t *kinds;
+    uint32_t *offsets;
+    Atom *atoms;
 } Tokens;
 
+// Lexes either a whole source buffer, or a stream read from fd through a bounded window. Only the
+// window and the interned text of identifier and literal tokens are kept when streaming.
 typedef struct {
-    Tokens array;
+    String buf;
     size_t position;
+    size_t offset; // Input offset of buf[0], bytes before it have been dropped from the window
+    int fd;        // -1 when buf holds the whole source
+    bool eof;
+
+    // Offsets at which each line after the first starts. Recorded while streaming since the source
+    // is dropped, otherwise found from buf the first time a line is asked for.
+    Lines lines;
+} Lexer;
+
+// Must be a power of two, and larger than the parser's lookahead plus how far checkn backtracks
+#define TOKEN_RING 16
+
+// Pulls tokens from the lexer as the parser asks for them, so lexing and parsing interleave and
+// only the last TOKEN_RING tokens are held, in the same parallel arrays as a whole stream. Indices
+// count tokens from the start of the input, the ring holds those in [start, end).
+typedef struct {
+    Lexer *lexer;
+    Tokens ring;
+    size_t start;
+    size_t end;
+    size_t position;
+    bool eof; // The T_EOF token has been buffered
 } TokenIter;
 
 TokenKind symbol_tokens[256];
 
 char *symbol_values[256];
 
-Tokens tokenise(const String *);
+Lexer lexer_from_string(const String *);
+Lexer lexer_from_fd(int);
+bool lex_token(Lexer *, Token *);
+size_t lexer_line(Lexer *, uint32_t);
+Tokens tokenise(Lexer *);
+
+Token token_at(const Tokens *, size_t);
+
+TokenIter token_iter(Lexer *);
+Token token_peek(TokenIter *, size_t);
+TokenKind token_peek_kind(TokenIter *, size_t);
 
-void print_tokens(const Tokens *);
+void print_tokens(Lexer *, const Tokens *);
@@ -2,7 +2,8 @@
 
 set -e
 
-make > main.b
+make main
+./main -o main.b examples/string
 
 ~/Projects/systems/stack/target/debug/stackc main.b
 rm main.b
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK (1 << 20)
+
+struct ArenaChunk {
+    ArenaChunk *prev;
+    size_t len;
+    size_t cap;
+    alignas(max_align_t) char data[];
+};
+
+Arena arena = {0};
+AllocStats alloc_stats = {0};
+
+void *arena_alloc(Arena *a, size_t size, size_t align) {
+    ArenaChunk *chunk = a->head;
+    size_t offset = 0;
+    if (chunk != nullptr) {
+        offset = (chunk->len + align - 1) & ~(align - 1);
+    }
+
+    if (chunk == nullptr || offset + size > chunk->cap) {
+        size_t cap = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        chunk = malloc(sizeof(ArenaChunk) + cap);
+        if (chunk == nullptr) {
+            fprintf(stderr, "malloc failed\n");
+            exit(1);
+        }
+        alloc_stats.mallocs++;
+        alloc_stats.bytes += sizeof(ArenaChunk) + cap;
+
+        chunk->prev = a->head;
+        chunk->len = 0;
+        chunk->cap = cap;
+        a->head = chunk;
+        a->chunks++;
+        offset = 0;
+    }
+
+    chunk->len = offset + size;
+    a->allocs++;
+
+    return &chunk->data[offset];
+}
+
+void *arena_copy(Arena *a, const void *src, size_t size) {
+    void *ptr = arena_alloc(a, size, 1);
+    memcpy(ptr, src, size);
+
+    return ptr;
+}
+
+void arena_free(Arena *a) {
+    ArenaChunk *chunk = a->head;
+    while (chunk != nullptr) {
+        ArenaChunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+
+    a->head = nullptr;
+    a->chunks = 0;
+    a->allocs = 0;
+}
@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "emit.h"
+
+Emitter out = {.fd = STDOUT_FILENO};
+
+// With no path, or "-", output goes to stdout
+void emit_open(Emitter *e, const char *path) {
+    e->len = 0;
+    e->fd = STDOUT_FILENO;
+    if (path == nullptr || strcmp(path, "-") == 0) {
+        return;
+    }
+
+    e->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (e->fd == -1) {
+        fprintf(stderr, "open %s: %s", path, strerror(errno));
+        exit(1);
+    }
+}
+
+static void write_all(int fd, const char *bytes, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, bytes, len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            fprintf(stderr, "write: %s", strerror(errno));
+            exit(1);
+        }
+
+        bytes += n;
+        len -= n;
+    }
+}
+
+void emit_flush(Emitter *e) {
+    write_all(e->fd, e->buf, e->len);
+    e->len = 0;
+}
+
+void emit_close(Emitter *e) {
+    emit_flush(e);
+    if (e->fd != STDOUT_FILENO) {
+        close(e->fd);
+    }
+}
+
+void emit_bytes(Emitter *e, const char *bytes, size_t len) {
+    if (e->len + len > EMIT_BUF) {
+        emit_flush(e);
+    }
+
+    // Only a huge string literal could be too big to buffer
+    if (len > EMIT_BUF) {
+        write_all(e->fd, bytes, len);
+        return;
+    }
+
+    memcpy(&e->buf[e->len], bytes, len);
+    e->len += len;
+}
+
+void emit_str(Emitter *e, const char *s) {
+    emit_bytes(e, s, strlen(s));
+}
+
+void emit_view(Emitter *e, const StringView *s) {
+    emit_bytes(e, s->items, s->len);
+}
+
+void emit_atom(Emitter *e, Atom atom) {
+    StringView s = atom_view(atom);
+    emit_view(e, &s);
+}
+
+void emit_char(Emitter *e, char c) {
+    if (e->len == EMIT_BUF) {
+        emit_flush(e);
+    }
+
+    e->buf[e->len++] = c;
+}
+
+void emit_long(Emitter *e, long n) {
+    char digits[24];
+    char *p = &digits[sizeof(digits)];
+
+    // Negate through unsigned so LONG_MIN doesn't overflow
+    unsigned long u = n < 0 ? -(unsigned long)n : (unsigned long)n;
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+    if (n < 0) {
+        *--p = '-';
+    }
+
+    emit_bytes(e, p, &digits[sizeof(digits)] - p);
+}
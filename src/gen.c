@@ -3,6 +3,8 @@
 #include <string.h>
 
 #include "array.h"
+#include "emit.h"
+#include "ir.h"
 #include "gen.h"
 #include "map.h"
 #include "str.h"
@@ -11,17 +13,23 @@
 static TypeInfo get_type(const Type *asttype) {
     TypeInfo type;
 
-    if (strcmp("int", asttype->name.items) == 0) {
+    switch (asttype->name) {
+    case A_INT:
         type = int_type;
-    } else if (strcmp("long", asttype->name.items) == 0) {
+        break;
+    case A_LONG:
         type = long_type;
-    } else if (strcmp("void", asttype->name.items) == 0) {
+        break;
+    case A_VOID:
         type = void_type;
-    } else if (strcmp("char", asttype->name.items) == 0) {
+        break;
+    case A_CHAR:
         type = char_type;
-    } else if (strcmp("byte", asttype->name.items) == 0) {
+        break;
+    case A_BYTE:
         type = byte_type;
-    } else {
+        break;
+    default:
         todo("unhandled return type");
     }
 
@@ -38,22 +46,21 @@ static TypeInfo get_type(const Type *asttype) {
 // TODO
 typedef enum { VariableSymbol, FunctionSymbol, RecordSymbol } SymbolKind;
 typedef struct {
-    String key;
+    Atom key;
     SymbolKind kind;
     TypeInfo type;    // The return type if it's a function, otherwise variable type
     int local;        // Set if it's a variable
+    int depth;        // Block nesting if it's a variable, 0 for arguments and the function body
     TypeInfos fnargs; // Set if it's a function
+    int frame;        // Slots a function's frame uses, -1 while it is being generated
 } Symbol;
 
 typedef struct {
     size_t len;
     size_t cap;
+    uint32_t generation;
+    MapSlot *slots;
     Symbol *items;
-} Symbols;
-
-typedef struct {
-    size_t cap;
-    Symbols *items;
 } SymbolMap;
 
 // Functions and record definitions stored here
@@ -61,61 +68,447 @@ SymbolMap global_symbols = {0};
 // Variables are stored here
 SymbolMap scoped_symbols = {0};
 
-int locals = 0;
 int labels = 0;
 int strings = 0;
 
+// Symbols shadowed by a definition in an inner block, restored when the block ends
+typedef struct {
+    Atom name;
+    bool shadows;
+    Symbol symbol;
+} ScopeEntry;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    ScopeEntry *items;
+} ScopeEntries;
+
+static ScopeEntries scope = {0};
+static int depth = 0;
+
+// Argument types of the function being generated
+static TypeInfos frame_args = {0};
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    int *items;
+} Ints;
+
+// Where a variable is defined and the last statement that refers to it, both as positions in a
+// preorder numbering of the function's statements. Arguments are defined at position -1.
+typedef struct {
+    int position;
+    int end;
+} LiveRange;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    LiveRange *items;
+} LiveRanges;
+
+// Frame slots are handed out first fit from `slots`, and given back once the statement that last
+// refers to their variable has been generated, so variables that are never live at the same time
+// share slots. `ranges` holds arguments first, then definitions in order, `defined_at` maps a
+// statement's position to its definition's range.
+typedef struct {
+    int end;
+    int local;
+    int size;
+} Occupant;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    Occupant *items;
+} Occupants;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    bool *items;
+} Slots;
+
+static LiveRanges ranges = {0};
+static Ints defined_at = {0};
+static Slots slots = {0};
+static Occupants occupants = {0};
+static int position = 0;
+
+// Expression and statement pools of the program being generated
+static const Program *program = nullptr;
+
+// Instructions of the function being generated
+static Instrs code = {0};
+
+static void ins_op(Opcode op, const char *ext) {
+    Instr ins = {.op = op, .ext = ext};
+    append(&code, ins);
+}
+
+static void ins_arg(Opcode op, const char *ext, long arg) {
+    Instr ins = {.op = op, .ext = ext, .arg = arg};
+    append(&code, ins);
+}
+
+static void ins_jmp(JumpCond cond, int label) {
+    Instr ins = {.op = I_JMP, .cond = cond, .ext = "", .arg = label};
+    append(&code, ins);
+}
+
+static void ins_label(int label) {
+    Instr ins = {.op = I_LABEL, .ext = "", .arg = label};
+    append(&code, ins);
+}
+
+/* Frame planning */
+
+typedef struct {
+    Atom key;
+    int range;
+} Binding;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    uint32_t generation;
+    MapSlot *slots;
+    Binding *items;
+} Bindings;
+
+typedef struct {
+    Atom name;
+    bool shadows;
+    Binding binding;
+} BindingEntry;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    BindingEntry *items;
+} BindingEntries;
+
+// A loop being planned, with the ranges referred to inside it
+typedef struct {
+    int start;
+    Ints touched;
+} PlanLoop;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    PlanLoop *items;
+} PlanLoops;
+
+static Bindings bindings = {0};
+static BindingEntries binding_scope = {0};
+static PlanLoops plan_loops = {0};
+static int plan_position = 0;
+static int plan_current = 0;
+
+static void plan_bind(Atom name, int range) {
+    Binding *prev = get(&bindings, name);
+    BindingEntry entry = {.name = name, .shadows = prev != nullptr};
+    if (prev != nullptr) {
+        entry.binding = *prev;
+    }
+    append(&binding_scope, entry);
+
+    Binding binding = {.key = name, .range = range};
+    insert(&bindings, binding);
+}
+
+static void plan_ref(Atom name) {
+    Binding *binding = get(&bindings, name);
+    if (binding == nullptr) {
+        return;
+    }
+
+    LiveRange *range = &ranges.items[binding->range];
+    if (range->end < plan_current) {
+        range->end = plan_current;
+    }
+    if (plan_loops.len > 0) {
+        append(&plan_loops.items[plan_loops.len - 1].touched, binding->range);
+    }
+}
+
+static void plan_expr(ExprId id) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+        break;
+    case E_IDENT:
+        plan_ref(expr->value.id.name);
+        break;
+    case E_BINARY_OP:
+        plan_expr(expr->value.b.left);
+        plan_expr(expr->value.b.right);
+        break;
+    case E_CALL:
+        for (size_t i = 0; i < expr->value.c.args.len; i++) {
+            plan_expr(list_at(program, &expr->value.c.args, i));
+        }
+        break;
+    }
+}
+
+static void plan_statement(const Statement *stmt);
+
+static void plan_block(const Block *block) {
+    size_t mark = binding_scope.len;
+    for (size_t i = 0; i < block->len; i++) {
+        plan_statement(stmt_at(program, block, i));
+    }
+
+    while (binding_scope.len > mark) {
+        BindingEntry *entry = &binding_scope.items[--binding_scope.len];
+        if (entry->shadows) {
+            insert(&bindings, entry->binding);
+        } else {
+            erase(&bindings, entry->name);
+        }
+    }
+}
+
+static void plan_statement(const Statement *stmt) {
+    int here = plan_position++;
+    plan_current = here;
+    append(&defined_at, -1);
+
+    switch (stmt->kind) {
+    case S_DEFINITION: {
+        LiveRange range = {.position = here, .end = here};
+        defined_at.items[here] = ranges.len;
+        plan_bind(stmt->value.d.decl.name, ranges.len);
+        append(&ranges, range);
+        plan_expr(stmt->value.d.expr);
+        break;
+    }
+    case S_ASSIGN:
+        plan_ref(stmt->value.a.name);
+        plan_expr(stmt->value.a.expr);
+        break;
+    case S_EXPR:
+        plan_expr(stmt->value.e.expr);
+        break;
+    case S_RETURN:
+        if (stmt->value.r.expr != NO_EXPR) {
+            plan_expr(stmt->value.r.expr);
+        }
+        break;
+    case S_IF:
+        plan_expr(stmt->value.i.expr);
+        plan_block(&stmt->value.i.stmts);
+        break;
+    case S_WHILE: {
+        // A variable from outside the loop that the loop refers to may be read again on the next
+        // iteration, so it lives until the end of the loop
+        PlanLoop loop = {.start = here};
+        append(&plan_loops, loop);
+        plan_expr(stmt->value.w.expr);
+        plan_block(&stmt->value.w.stmts);
+
+        loop = plan_loops.items[--plan_loops.len];
+        int end = plan_position - 1;
+        for (size_t i = 0; i < loop.touched.len; i++) {
+            LiveRange *range = &ranges.items[loop.touched.items[i]];
+            if (range->position < loop.start) {
+                if (range->end < end) {
+                    range->end = end;
+                }
+                if (plan_loops.len > 0) {
+                    append(&plan_loops.items[plan_loops.len - 1].touched, loop.touched.items[i]);
+                }
+            }
+        }
+        arrayfree(&loop.touched);
+        break;
+    }
+    }
+}
+
+static void plan_function(const Function *func) {
+    clear(&bindings);
+    binding_scope.len = 0;
+    ranges.len = 0;
+    defined_at.len = 0;
+    plan_position = 0;
+
+    for (size_t i = 0; i < func->args.len; i++) {
+        LiveRange range = {.position = -1, .end = -1};
+        plan_bind(func->args.items[i].name, ranges.len);
+        append(&ranges, range);
+    }
+
+    for (size_t i = 0; i < func->stmts.len; i++) {
+        plan_statement(stmt_at(program, &func->stmts, i));
+    }
+}
+
+// First fit, so a 2 slot long can fill a gap left by two ints
+static int take_slot(int size, int end) {
+    int local = 0;
+    for (int run = 0; local + run < (int)slots.len && run < size;) {
+        if (slots.items[local + run]) {
+            local += run + 1;
+            run = 0;
+        } else {
+            run++;
+        }
+    }
+
+    while ((int)slots.len < local + size) {
+        append(&slots, false);
+    }
+    for (int i = 0; i < size; i++) {
+        slots.items[local + i] = true;
+    }
+
+    Occupant occupant = {.end = end, .local = local, .size = size};
+    append(&occupants, occupant);
+
+    return local;
+}
+
+static void release_slots(int here) {
+    for (size_t i = 0; i < occupants.len;) {
+        Occupant *occupant = &occupants.items[i];
+        if (occupant->end >= here) {
+            i++;
+            continue;
+        }
+
+        for (int j = 0; j < occupant->size; j++) {
+            slots.items[occupant->local + j] = false;
+        }
+        occupants.items[i] = occupants.items[--occupants.len];
+    }
+}
+
+/* Scopes */
+
+static void define_variable(const Symbol *sym, const char *what) {
+    Symbol *prev = get(&scoped_symbols, sym->key);
+    if (prev != nullptr && prev->depth == depth) {
+        panic("%s redefined: %.*s", what, atom_fmt(sym->key));
+    }
+
+    ScopeEntry entry = {.name = sym->key, .shadows = prev != nullptr};
+    if (prev != nullptr) {
+        entry.symbol = *prev;
+    }
+    append(&scope, entry);
+
+    insert(&scoped_symbols, *sym);
+}
+
+static void gen_block(const TypeInfo *fntype, const Block *block) {
+    size_t mark = scope.len;
+    depth++;
+
+    for (size_t i = 0; i < block->len; i++) {
+        gen_statement(fntype, stmt_at(program, block, i));
+    }
+
+    depth--;
+    while (scope.len > mark) {
+        ScopeEntry *entry = &scope.items[--scope.len];
+        if (entry->shadows) {
+            insert(&scoped_symbols, entry->symbol);
+        } else {
+            erase(&scoped_symbols, entry->name);
+        }
+    }
+}
+
 void gen_program(const Program *prg) {
-    printf(".entry main\n\n");
+    program = prg;
+
+    emit_str(&out, ".entry main\n\n");
 
     for (size_t i = 0; i < prg->funcs.len; i++) {
         gen_function(&prg->funcs.items[i]);
-        printf("\n");
+
+        peephole_run(&code);
+        ir_emit(&out, &code);
+        code.len = 0;
+        emit_char(&out, '\n');
     }
 }
 
+// Generate the program as written and throw the code away, so every error the code generator
+// reports is raised before the optimizer can rewrite or remove the code that causes it
+void gen_check(const Program *prg) {
+    program = prg;
+
+    for (size_t i = 0; i < prg->funcs.len; i++) {
+        gen_function(&prg->funcs.items[i]);
+        code.len = 0;
+    }
+
+    for (size_t i = 0; i < global_symbols.cap; i++) {
+        if (global_symbols.slots[i].generation == global_symbols.generation) {
+            arrayfree(&global_symbols.items[i].fnargs);
+        }
+    }
+    clear(&global_symbols);
+    labels = 0;
+    strings = 0;
+}
+
 void gen_function(const Function *func) {
     const Declaration *decl = &func->decl;
     const Declarations *args = &func->args;
-    const Statements *stmts = &func->stmts;
+    const Block *stmts = &func->stmts;
 
     TypeInfo type = get_type(&decl->type);
 
     TypeInfos fnargs = {0};
-    Symbol fnsym = {.key = func->decl.name, .type = type, .kind = FunctionSymbol};
-    if (get(&global_symbols, &fnsym.key) != nullptr) {
-        panic("function redefined: %.*s", (int)fnsym.key.len, fnsym.key.items);
+    Symbol fnsym = {.key = func->decl.name, .type = type, .kind = FunctionSymbol, .frame = -1};
+    if (get(&global_symbols, fnsym.key) != nullptr) {
+        panic("function redefined: %.*s", atom_fmt(fnsym.key));
     }
 
     clear(&scoped_symbols);
-    locals = 0;
+    scope.len = 0;
+    depth = 0;
+    slots.len = 0;
+    occupants.len = 0;
+    position = 0;
+    plan_function(func);
+
+    // Arguments are passed in the first slots, in order
     for (size_t i = 0; i < args->len; i++) {
         TypeInfo type = get_type(&args->items[i].type);
-        int local = locals;
-        locals += type.slotsize;
+        int local = take_slot(type.slotsize, ranges.items[i].end);
 
         Symbol sym = {
             .key = args->items[i].name, .local = local, .type = type, .kind = VariableSymbol};
-        if (get(&scoped_symbols, &sym.key) != nullptr) {
-            panic("function argument redefined: %.*s", (int)sym.key.len, sym.key.items);
-        }
-
-        insert(&scoped_symbols, sym);
+        define_variable(&sym, "function argument");
         append(&fnargs, type);
     }
 
     fnsym.fnargs = fnargs;
+    frame_args = fnargs;
     insert(&global_symbols, fnsym);
 
-    printf("%.*s:\n", (int)func->decl.name.len, func->decl.name.items);
+    Instr label = {.op = I_FUNC, .ext = "", .name = func->decl.name};
+    append(&code, label);
     for (size_t i = 0; i < stmts->len; i++) {
-        gen_statement(&type, &stmts->items[i]);
+        gen_statement(&type, stmt_at(program, stmts, i));
     }
+    get(&global_symbols, func->decl.name)->frame = slots.len;
 
     // TODO: check ret
 }
 
 void gen_statement(const TypeInfo *fntype, const Statement *stmt) {
+    release_slots(position++);
+
     switch (stmt->kind) {
     case S_ASSIGN:
         gen_assign_statement(&stmt->value.a);
@@ -141,174 +534,334 @@ void gen_statement(const TypeInfo *fntype, const Statement *stmt) {
 void gen_assign_statement(const AssignStatement *stmt) {
     ExprContext ctx = {0};
 
-    Symbol *sym0 = get(&scoped_symbols, &stmt->name);
+    Symbol *sym0 = get(&scoped_symbols, stmt->name);
     if (sym0 == nullptr) {
-        panic("attempt to assign undeclared variable: %.*s", (int)stmt->name.len, stmt->name.items);
+        panic("attempt to assign undeclared variable: %.*s", atom_fmt(stmt->name));
     }
 
     ctx.type = &sym0->type;
-    gen_expr(&ctx, &stmt->expr);
-    printf("store%s %d\n", sym0->type.opext, sym0->local);
+    gen_expr(&ctx, stmt->expr);
+    ins_arg(I_STORE, sym0->type.opext, sym0->local);
 }
 
+static bool has_call(ExprId id) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+    case E_IDENT:
+        return false;
+    case E_BINARY_OP:
+        return has_call(expr->value.b.left) || has_call(expr->value.b.right);
+    case E_CALL:
+        return true;
+    }
+
+    return true;
+}
+
+// The value is discarded. Without a call the expression can't have an effect, so its code is
+// dropped once it has been checked, otherwise the result is popped so loops don't grow the stack.
 void gen_expr_statement(const ExprStatement *estmt) {
     ExprContext ctx = {0};
+    size_t mark = code.len;
 
     ctx.settype = true;
-    gen_expr(&ctx, &estmt->expr);
+    gen_expr(&ctx, estmt->expr);
+
+    if (!has_call(estmt->expr)) {
+        code.len = mark;
+        return;
+    }
+
+    if (ctx.type->kind != Void) {
+        // A call leaves its result as the callee returned it
+        bool call = expr_at(program, estmt->expr)->kind == E_CALL;
+        ins_op(I_POP, call ? ctx.type->retext : ctx.type->opext);
+    }
 }
 
 void gen_definition_statement(const DefinitionStatement *stmt) {
     ExprContext ctx = {0};
 
     TypeInfo type = get_type(&stmt->decl.type);
-    int local = locals;
-    locals += type.slotsize;
-    Symbol sym = {.key = stmt->decl.name, .local = local, .type = type, .kind = VariableSymbol};
-
-    if (get(&scoped_symbols, &sym.key) != nullptr) {
-        panic("variable redefined: %.*s", (int)sym.key.len, sym.key.items);
-    }
-
-    insert(&scoped_symbols, sym);
+    const LiveRange *range = &ranges.items[defined_at.items[position - 1]];
+    int local = take_slot(type.slotsize, range->end);
+    Symbol sym = {
+        .key = stmt->decl.name, .local = local, .type = type, .depth = depth,
+        .kind = VariableSymbol};
+    define_variable(&sym, "variable");
 
     ctx.type = &type;
-    gen_expr(&ctx, &stmt->expr);
-    printf("store%s %d\n", sym.type.opext, sym.local);
+    gen_expr(&ctx, stmt->expr);
+    ins_arg(I_STORE, sym.type.opext, sym.local);
 }
 
 void gen_if_statement(const TypeInfo *fntype, const IfStatement *stmt) {
-    ExprContext ctx = {0};
+    int done = labels++;
+    gen_branch(stmt->expr, false, done);
+    gen_block(fntype, &stmt->stmts);
 
-    ctx.settype = true;
-    gen_expr(&ctx, &stmt->expr);
+    ins_label(done);
+}
 
-    char *opext = "";
-    if (ctx.type != nullptr) {
-        opext = ctx.type->opext;
+// The test is at the bottom, so each iteration takes a single branch back to the body, and the
+// loop is entered by jumping to the test once
+void gen_while_statement(const TypeInfo *fntype, const WhileStatement *stmt) {
+    int body = labels++;
+    int test = labels++;
+
+    ins_jmp(J_ALWAYS, test);
+    ins_label(body);
+    gen_block(fntype, &stmt->stmts);
+    ins_label(test);
+    gen_branch(stmt->expr, true, body);
+}
+
+static bool cmp_cond(BinaryOp op, JumpCond *cond) {
+    switch (op) {
+    case OP_LT:
+        *cond = J_LT;
+        return true;
+    case OP_LE:
+        *cond = J_LE;
+        return true;
+    case OP_GT:
+        *cond = J_GT;
+        return true;
+    case OP_GE:
+        *cond = J_GE;
+        return true;
+    case OP_EQY:
+        *cond = J_EQ;
+        return true;
+    case OP_NEQY:
+        *cond = J_NE;
+        return true;
+    default:
+        return false;
     }
+}
 
-    int done = labels++;
-    printf("push%s 0\n", opext);
-    printf("cmp%s\n", opext);
-    printf("jmp.eq l%d\n", done);
-    for (size_t i = 0; i < stmt->stmts.len; i++) {
-        gen_statement(fntype, &stmt->stmts.items[i]);
+// Generate a condition as control flow rather than a value: jump to label when its truth equals
+// `when`, otherwise fall through. A comparison becomes a single cmp and conditional jump, and
+// && and || chains jump out as soon as an operand decides them.
+void gen_branch(ExprId id, bool when, int label) {
+    const Expr *expr = expr_at(program, id);
+
+    // A constant condition is either an unconditional jump or nothing at all
+    if (expr->kind == E_VALUE && expr->value.v.kind == V_NUMBER) {
+        if ((expr->value.v.value.num != 0) == when) {
+            ins_jmp(J_ALWAYS, label);
+        }
+        return;
     }
 
-    printf("l%d:\n", done);
+    if (expr->kind == E_BINARY_OP) {
+        const BinaryOpExpr *bop = &expr->value.b;
+
+        JumpCond cond;
+        if (cmp_cond(bop->op, &cond)) {
+            ExprContext ctx = {.settype = true};
+            gen_expr(&ctx, bop->left);
+            gen_expr(&ctx, bop->right);
+
+            char *opext = ctx.type != nullptr ? ctx.type->opext : "";
+            ins_op(I_CMP, opext);
+            ins_jmp(when ? cond : jump_invert(cond), label);
+            return;
+        }
+
+        // a && b is false, and a || b true, as soon as a is
+        if (bop->op == OP_LAND || bop->op == OP_LOR) {
+            bool decides = bop->op == OP_LOR;
+            if (when == decides) {
+                gen_branch(bop->left, when, label);
+                gen_branch(bop->right, when, label);
+            } else {
+                int skip = labels++;
+                gen_branch(bop->left, decides, skip);
+                gen_branch(bop->right, when, label);
+                ins_label(skip);
+            }
+            return;
+        }
+    }
+
+    ExprContext ctx = {.settype = true};
+    gen_expr(&ctx, id);
+
+    char *opext = ctx.type != nullptr ? ctx.type->opext : "";
+    ins_arg(I_PUSH, opext, 0);
+    ins_op(I_CMP, opext);
+    ins_jmp(when ? J_NE : J_EQ, label);
 }
 
-void gen_while_statement(const TypeInfo *fntype, const WhileStatement *stmt) {
-    ExprContext ctx = {0};
+static Symbol *call_symbol(const CallExpr *);
+static void gen_call_arg(const Symbol *, const CallExpr *, size_t);
 
-    int start = labels++;
-    printf("l%d:\n", start);
+static bool same_typeinfo(const TypeInfo *a, const TypeInfo *b) {
+    return a->kind == b->kind && a->pointer == b->pointer && strcmp(a->opext, b->opext) == 0;
+}
 
-    ctx.settype = true;
-    gen_expr(&ctx, &stmt->expr);
-    char *opext = "";
-    if (ctx.type != nullptr) {
-        opext = ctx.type->opext;
+// Whether argument i of a tail call is a variable already held in the slot it is passed in
+static bool arg_in_place(const CallExpr *call, size_t i, int slot) {
+    const Expr *arg = expr_at(program, list_at(program, &call->args, i));
+    if (arg->kind != E_IDENT) {
+        return false;
     }
 
-    int done = labels++;
-    printf("push%s 0\n", opext);
-    printf("cmp%s\n", opext);
-    printf("jmp.eq l%d\n", done);
-    for (size_t i = 0; i < stmt->stmts.len; i++) {
-        gen_statement(fntype, &stmt->stmts.items[i]);
+    Symbol *sym = get(&scoped_symbols, arg->value.id.name);
+    return sym != nullptr && sym->local == slot && same_typeinfo(&sym->type, &frame_args.items[i]);
+}
+
+// A call in tail position reuses the current frame when the callee returns the same type, takes
+// its arguments in the same slots and needs no more slots than the frame has: the arguments are
+// stored over this function's own and the callee is jumped to rather than called, so deep
+// recursion runs in constant stack. An argument already in its slot is left there.
+static bool gen_tail_call(const TypeInfo *fntype, ExprId id) {
+    const Expr *expr = expr_at(program, id);
+    if (expr->kind != E_CALL) {
+        return false;
     }
-    printf("jmp l%d\n", start);
-    printf("l%d:\n", done);
+
+    const CallExpr *call = &expr->value.c;
+    Symbol *fnsym = get(&global_symbols, call->name);
+    if (fnsym == nullptr || !same_typeinfo(&fnsym->type, fntype) ||
+        fnsym->fnargs.len != frame_args.len) {
+        return false;
+    }
+
+    for (size_t i = 0; i < frame_args.len; i++) {
+        if (!same_typeinfo(&fnsym->fnargs.items[i], &frame_args.items[i])) {
+            return false;
+        }
+    }
+
+    // The frame can still grow, but never shrinks, so this errs on the safe side
+    if (fnsym->frame > (int)slots.len) {
+        return false;
+    }
+
+    call_symbol(call);
+
+    int slot = 0;
+    for (size_t i = 0; i < frame_args.len; i++) {
+        if (!arg_in_place(call, i, slot)) {
+            gen_call_arg(fnsym, call, i);
+        }
+        slot += frame_args.items[i].slotsize;
+    }
+    for (size_t i = frame_args.len; i-- > 0;) {
+        slot -= frame_args.items[i].slotsize;
+        if (!arg_in_place(call, i, slot)) {
+            ins_arg(I_STORE, frame_args.items[i].opext, slot);
+        }
+    }
+
+    Instr jmp = {.op = I_TAIL, .ext = "", .name = call->name};
+    append(&code, jmp);
+
+    return true;
 }
 
 void gen_return_statement(const TypeInfo *fntype, const ReturnStatement *stmt) {
     ExprContext ctx = {0};
 
-    if (fntype->kind == Void && stmt->expr != nullptr) {
+    if (fntype->kind == Void && stmt->expr != NO_EXPR) {
         panic("unexpected return expression, function type is void");
     }
-    if (fntype->kind != Void && stmt->expr == nullptr) {
+    if (fntype->kind != Void && stmt->expr == NO_EXPR) {
         panic("missing return expression, function type is not void");
     }
 
+    if (stmt->expr != NO_EXPR && gen_tail_call(fntype, stmt->expr)) {
+        return;
+    }
+
     ctx.type = fntype;
-    if (stmt->expr != nullptr) {
+    if (stmt->expr != NO_EXPR) {
         gen_expr(&ctx, stmt->expr);
     }
 
-    printf("ret%s\n", fntype->retext);
+    ins_op(I_RET, fntype->retext);
 }
 
 void gen_op(const char *opext, BinaryOp op) {
     switch (op) {
     case OP_ADD:
-        printf("add%s\n", opext);
+        ins_op(I_ADD, opext);
         break;
     case OP_SUB:
-        printf("sub%s\n", opext);
+        ins_op(I_SUB, opext);
         break;
     case OP_MUL:
-        printf("mul%s\n", opext);
+        ins_op(I_MUL, opext);
         break;
     case OP_DIV:
-        printf("div%s\n", opext);
+        ins_op(I_DIV, opext);
         break;
     case OP_LT:
-        gen_cmp_op(opext, "lt");
+        gen_cmp_op(opext, J_LT);
         break;
     case OP_LE:
-        gen_cmp_op(opext, "le");
+        gen_cmp_op(opext, J_LE);
         break;
     case OP_GT:
-        gen_cmp_op(opext, "gt");
+        gen_cmp_op(opext, J_GT);
         break;
     case OP_GE:
-        gen_cmp_op(opext, "ge");
+        gen_cmp_op(opext, J_GE);
         break;
     case OP_EQY:
-        gen_cmp_op(opext, "eq");
+        gen_cmp_op(opext, J_EQ);
         break;
     case OP_NEQY:
-        gen_cmp_op(opext, "ne");
+        gen_cmp_op(opext, J_NE);
         break;
     case OP_LAND:
-        gen_logical_op(opext, 2);
-        break;
     case OP_LOR:
-        gen_logical_op(opext, 1);
+        // Generated by gen_logical_expr, since the right operand may be skipped
         break;
     }
 }
 
-void gen_cmp_op(const char *opext, const char *jmpext) {
+void gen_cmp_op(const char *opext, JumpCond cond) {
     int iftrue = labels++;
     int cont = labels++;
-    printf("cmp%s\n", opext);
-    printf("jmp.%s l%d\n", jmpext, iftrue);
-    printf("push%s 0\n", opext);
-    printf("jmp l%d\n", cont);
-    printf("l%d:\n", iftrue);
-    printf("push%s 1\n", opext);
-    printf("l%d:\n", cont);
+    ins_op(I_CMP, opext);
+    ins_jmp(cond, iftrue);
+    ins_arg(I_PUSH, opext, 0);
+    ins_jmp(J_ALWAYS, cont);
+    ins_label(iftrue);
+    ins_arg(I_PUSH, opext, 1);
+    ins_label(cont);
 }
 
-void gen_logical_op(const char *opext, int ntrue) {
-    int iftrue = labels++;
+// The value of a && b or a || b. The operands are generated as branches, so the right one is only
+// evaluated when the left doesn't decide the result.
+void gen_logical_expr(ExprContext *ctx, const BinaryOpExpr *expr) {
+    if (ctx->settype) {
+        ctx->type = &int_type;
+        ctx->settype = false;
+    }
+    char *opext = ctx->type != nullptr ? ctx->type->opext : "";
+
+    bool decides = expr->op == OP_LOR;
+    int decided = labels++;
     int cont = labels++;
-    printf("add\n");
-    printf("push%s %d\n", opext, ntrue);
-    printf("cmp%s\n", opext);
-    printf("jmp.ge l%d\n", iftrue);
-    printf("push%s 0\n", opext);
-    printf("jmp l%d\n", cont);
-    printf("l%d:\n", iftrue);
-    printf("push%s 1\n", opext);
-    printf("l%d:\n", cont);
-}
-
-void gen_expr(ExprContext *ctx, const Expr *expr) {
+    gen_branch(expr->left, decides, decided);
+    gen_branch(expr->right, decides, decided);
+    ins_arg(I_PUSH, opext, !decides);
+    ins_jmp(J_ALWAYS, cont);
+    ins_label(decided);
+    ins_arg(I_PUSH, opext, decides);
+    ins_label(cont);
+}
+
+void gen_expr(ExprContext *ctx, ExprId id) {
+    const Expr *expr = expr_at(program, id);
+
     switch (expr->kind) {
     case E_VALUE:
         gen_value_expr(ctx, &expr->value.v);
@@ -330,7 +883,7 @@ void gen_value_expr(ExprContext *ctx, const ValueExpr *expr) {
 
     switch (expr->kind) {
     case V_NUMBER:
-        printf("push%s %ld\n", opext, expr->value.num);
+        ins_arg(I_PUSH, opext, expr->value.num);
 
         if (ctx->settype) {
             ctx->type = &int_type;
@@ -339,8 +892,9 @@ void gen_value_expr(ExprContext *ctx, const ValueExpr *expr) {
         break;
     case V_STRING:
         int s = strings++;
-        printf(".data s%d .string \"%.*s\"\n", s, (int)expr->value.str.len, expr->value.str.items);
-        printf("dataptr s%d\n", s);
+        Instr data = {.op = I_DATA, .ext = "", .arg = s, .text = expr->value.str};
+        append(&code, data);
+        ins_arg(I_DATAPTR, "", s);
 
         if (ctx->settype) {
             ctx->type = &char_ptr_type;
@@ -349,7 +903,8 @@ void gen_value_expr(ExprContext *ctx, const ValueExpr *expr) {
 
         break;
     case V_CHAR:
-        printf("push%s '%.*s'\n", opext, (int)expr->value.ch.len, expr->value.ch.items);
+        Instr push = {.op = I_PUSH_CHAR, .ext = opext, .text = expr->value.ch};
+        append(&code, push);
 
         if (ctx->settype) {
             ctx->type = &char_type;
@@ -360,6 +915,11 @@ void gen_value_expr(ExprContext *ctx, const ValueExpr *expr) {
 }
 
 void gen_binary_op_expr(ExprContext *ctx, const BinaryOpExpr *expr) {
+    if (expr->op == OP_LAND || expr->op == OP_LOR) {
+        gen_logical_expr(ctx, expr);
+        return;
+    }
+
     gen_expr(ctx, expr->left);
     gen_expr(ctx, expr->right);
 
@@ -369,9 +929,9 @@ void gen_binary_op_expr(ExprContext *ctx, const BinaryOpExpr *expr) {
 }
 
 void gen_ident_expr(ExprContext *ctx, const IdentExpr *expr) {
-    Symbol *sym = get(&scoped_symbols, &expr->name);
+    Symbol *sym = get(&scoped_symbols, expr->name);
     if (sym == nullptr) {
-        panic("%.*s used before declaration", (int)expr->name.len, expr->name.items);
+        panic("%.*s used before declaration", atom_fmt(expr->name));
     }
 
     if (sym->type.kind == Void) {
@@ -387,36 +947,54 @@ void gen_ident_expr(ExprContext *ctx, const IdentExpr *expr) {
         ctx->settype = false;
     }
 
-    printf("load%s %d\n", sym->type.opext, sym->local);
+    ins_arg(I_LOAD, sym->type.opext, sym->local);
 }
 
-void gen_call_expr(ExprContext *ctx, const CallExpr *expr) {
-    Symbol *fnsym = get(&global_symbols, &expr->name);
-
-    if (ctx->settype) {
-        ctx->type = &fnsym->type;
-        ctx->settype = false;
-    }
-
+// The callee of a call, checked to take as many arguments as it is passed
+static Symbol *call_symbol(const CallExpr *expr) {
+    Symbol *fnsym = get(&global_symbols, expr->name);
     if (fnsym == nullptr) {
-        panic("call to undefined function: %.*s\n", (int)expr->name.len, expr->name.items);
+        panic("call to undefined function: %.*s\n", atom_fmt(expr->name));
     }
 
     if (fnsym->fnargs.len != expr->args.len) {
-        panic("call %.*s: argument count mismatch, have %ld, want %ld\n", (int)expr->name.len,
-              expr->name.items, expr->args.len, fnsym->fnargs.len);
+        panic("call %.*s: argument count mismatch, have %u, want %ld\n", atom_fmt(expr->name),
+              expr->args.len, fnsym->fnargs.len);
     }
 
+    return fnsym;
+}
+
+// Push argument i of a call, checked against the callee's parameter
+static void gen_call_arg(const Symbol *fnsym, const CallExpr *expr, size_t i) {
+    ExprContext ctx = {0};
+    ctx.settype = true;
+    gen_expr(&ctx, list_at(program, &expr->args, i));
+
+    TypeInfo argtype = fnsym->fnargs.items[i];
+    if (argtype.kind != ctx.type->kind || (argtype.pointer ^ ctx.type->pointer) == true) {
+        panic("call %.*s: argument type mismatch\n", atom_fmt(expr->name));
+    }
+}
+
+// Check a call against its callee and push its arguments
+static void gen_call_args(const CallExpr *expr) {
+    Symbol *fnsym = call_symbol(expr);
     for (size_t i = 0; i < expr->args.len; i++) {
-        ExprContext ctx = {0};
-        ctx.settype = true;
-        gen_expr(&ctx, &expr->args.items[i]);
+        gen_call_arg(fnsym, expr, i);
+    }
+}
 
-        TypeInfo argtype = fnsym->fnargs.items[i];
-        if (argtype.kind != ctx.type->kind || (argtype.pointer ^ ctx.type->pointer) == true) {
-            panic("call %.*s: argument type mismatch\n", (int)expr->name.len, expr->name.items);
-        }
+void gen_call_expr(ExprContext *ctx, const CallExpr *expr) {
+    Symbol *fnsym = get(&global_symbols, expr->name);
+
+    if (ctx->settype) {
+        ctx->type = &fnsym->type;
+        ctx->settype = false;
     }
 
-    printf("call %.*s\n", (int)expr->name.len, expr->name.items);
+    gen_call_args(expr);
+
+    Instr call = {.op = I_CALL, .ext = "", .name = expr->name};
+    append(&code, call);
 }
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "array.h"
+#include "intern.h"
+#include "map.h"
+
+static const char *builtins[] = {
+    [A_IF] = "if",     [A_ELSE] = "else", [A_WHILE] = "while", [A_FOR] = "for",
+    [A_RETURN] = "return", [A_NULL] = "null", [A_VOID] = "void", [A_BYTE] = "byte",
+    [A_CHAR] = "char", [A_INT] = "int",   [A_LONG] = "long",
+};
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    StringView *items;
+} AtomTexts;
+
+// The text of each atom, indexed by atom
+static AtomTexts texts = {0};
+
+// Open addressing table of atoms keyed by their text, A_NONE marks an empty slot. Each slot keeps
+// the text's hash so probes can skip other atoms without touching their text.
+typedef struct {
+    uint32_t hash;
+    Atom atom;
+} InternSlot;
+
+static InternSlot *slots = nullptr;
+static size_t nslots = 0;
+
+static void grow_slots(void) {
+    size_t n = nslots == 0 ? 256 : nslots * 2;
+    InternSlot *fresh = calloc(n, sizeof(InternSlot));
+    if (fresh == nullptr) {
+        fprintf(stderr, "calloc failed\n");
+        exit(1);
+    }
+    alloc_stats.mallocs++;
+    alloc_stats.bytes += n * sizeof(InternSlot);
+
+    for (size_t i = 0; i < nslots; i++) {
+        if (slots[i].atom == A_NONE) {
+            continue;
+        }
+
+        size_t slot = slots[i].hash & (n - 1);
+        while (fresh[slot].atom != A_NONE) {
+            slot = (slot + 1) & (n - 1);
+        }
+        fresh[slot] = slots[i];
+    }
+
+    free(slots);
+    slots = fresh;
+    nslots = n;
+}
+
+static Atom lookup_or_insert(const StringView *s) {
+    // Keep the load factor under 3/4
+    if ((texts.len + 1) * 4 >= nslots * 3) {
+        grow_slots();
+    }
+
+    uint32_t h = hash_string(s);
+    size_t slot = h & (nslots - 1);
+    for (; slots[slot].atom != A_NONE; slot = (slot + 1) & (nslots - 1)) {
+        if (slots[slot].hash != h) {
+            continue;
+        }
+
+        const StringView *t = &texts.items[slots[slot].atom];
+        if (t->len == s->len && memcmp(t->items, s->items, s->len) == 0) {
+            return slots[slot].atom;
+        }
+    }
+
+    StringView text = {.items = arena_copy(&arena, s->items, s->len), .len = s->len};
+    Atom a = texts.len;
+    append(&texts, text);
+    slots[slot] = (InternSlot){.hash = h, .atom = a};
+
+    return a;
+}
+
+static void intern_builtins(void) {
+    StringView none = {0};
+    append(&texts, none);
+
+    for (size_t i = A_NONE + 1; i < A_BUILTINS; i++) {
+        StringView s = {.items = builtins[i], .len = strlen(builtins[i])};
+        lookup_or_insert(&s);
+    }
+}
+
+Atom intern(const StringView *s) {
+    if (texts.len == 0) {
+        intern_builtins();
+    }
+
+    return lookup_or_insert(s);
+}
+
+StringView atom_view(Atom a) {
+    return texts.items[a];
+}
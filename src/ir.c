@@ -0,0 +1,447 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "array.h"
+#include "ir.h"
+
+PeepholeConfig peephole = {.enabled = {true, true, true, true, true, true, true, true}};
+
+const char *peephole_names[P_COUNT] = {
+    [P_STORE_LOAD] = "store-load",
+    [P_IDENTITY] = "identity",
+    [P_JMP_NEXT] = "jmp-next",
+    [P_UNREACHABLE] = "unreachable",
+    [P_PUSH_POP] = "push-pop",
+    [P_THREAD] = "thread",
+    [P_DEAD_LABEL] = "dead-label",
+    [P_DEAD_STORE] = "dead-store",
+};
+
+static const char *op_names[] = {
+    [I_PUSH] = "push", [I_PUSH_CHAR] = "push", [I_LOAD] = "load", [I_STORE] = "store",
+    [I_DUP] = "dup",   [I_POP] = "pop",        [I_ADD] = "add",   [I_SUB] = "sub",
+    [I_MUL] = "mul",   [I_DIV] = "div",        [I_CMP] = "cmp",   [I_RET] = "ret",
+};
+
+static const char *cond_names[] = {
+    [J_EQ] = "eq", [J_NE] = "ne", [J_LT] = "lt", [J_LE] = "le", [J_GT] = "gt", [J_GE] = "ge",
+};
+
+JumpCond jump_invert(JumpCond cond) {
+    switch (cond) {
+    case J_LT:
+        return J_GE;
+    case J_LE:
+        return J_GT;
+    case J_GT:
+        return J_LE;
+    case J_GE:
+        return J_LT;
+    case J_EQ:
+        return J_NE;
+    case J_NE:
+        return J_EQ;
+    default:
+        return cond;
+    }
+}
+
+// Enable the comma separated list of rewrites, or "all" or "none" of them
+bool peephole_parse(const char *list) {
+    bool all = strcmp(list, "all") == 0;
+    for (size_t i = 0; i < P_COUNT; i++) {
+        peephole.enabled[i] = all;
+    }
+    if (all || strcmp(list, "none") == 0) {
+        return true;
+    }
+
+    while (*list != '\0') {
+        size_t len = strcspn(list, ",");
+
+        size_t i = 0;
+        while (i < P_COUNT &&
+               (strlen(peephole_names[i]) != len || strncmp(peephole_names[i], list, len) != 0)) {
+            i++;
+        }
+        if (i == P_COUNT) {
+            return false;
+        }
+        peephole.enabled[i] = true;
+
+        list += len;
+        if (*list == ',') {
+            list++;
+        }
+    }
+
+    return true;
+}
+
+static size_t rewrite_settle(Instr *code, size_t len);
+
+static bool ends_block(const Instr *ins) {
+    return (ins->op == I_JMP && ins->cond == J_ALWAYS) || ins->op == I_TAIL || ins->op == I_RET;
+}
+
+// Rewrite the last instructions of code[0:len], returning the new length, or len if nothing matched
+static size_t rewrite_tail(Instr *code, size_t len) {
+    if (len < 2) {
+        return len;
+    }
+
+    Instr *a = &code[len - 2];
+    Instr *b = &code[len - 1];
+
+    if (peephole.enabled[P_STORE_LOAD] && a->op == I_STORE && b->op == I_LOAD &&
+        a->arg == b->arg && strcmp(a->ext, b->ext) == 0) {
+        peephole.hits[P_STORE_LOAD]++;
+        *b = *a;
+        *a = (Instr){.op = I_DUP, .ext = b->ext};
+        // Same length, but the pair no longer matches so this can't loop
+        return len;
+    }
+
+    if (peephole.enabled[P_IDENTITY] && a->op == I_PUSH &&
+        ((a->arg == 0 && (b->op == I_ADD || b->op == I_SUB)) ||
+         (a->arg == 1 && (b->op == I_MUL || b->op == I_DIV)))) {
+        peephole.hits[P_IDENTITY]++;
+        return len - 2;
+    }
+
+    if (peephole.enabled[P_JMP_NEXT] && a->op == I_JMP && a->cond == J_ALWAYS &&
+        b->op == I_LABEL && a->arg == b->arg) {
+        peephole.hits[P_JMP_NEXT]++;
+        *a = *b;
+        return len - 1;
+    }
+
+    // The flag goes unused but the compared values still have to come off the stack. The label
+    // is set aside while what comes before it is rewritten, since that can pop into earlier code.
+    if (peephole.enabled[P_JMP_NEXT] && len >= 3 && code[len - 3].op == I_CMP && a->op == I_JMP &&
+        b->op == I_LABEL && a->arg == b->arg) {
+        peephole.hits[P_JMP_NEXT]++;
+        Instr label = *b;
+        const char *ext = code[len - 3].ext;
+        code[len - 3] = (Instr){.op = I_POP, .ext = ext};
+        code[len - 2] = (Instr){.op = I_POP, .ext = ext};
+        len = rewrite_settle(code, len - 1);
+        code[len++] = label;
+        return len;
+    }
+
+    if (peephole.enabled[P_PUSH_POP] && b->op == I_POP &&
+        (a->op == I_PUSH || a->op == I_PUSH_CHAR || a->op == I_LOAD || a->op == I_DUP ||
+         a->op == I_DATAPTR)) {
+        peephole.hits[P_PUSH_POP]++;
+        return len - 2;
+    }
+
+    return len;
+}
+
+static size_t rewrite_settle(Instr *code, size_t len) {
+    for (size_t prev = 0; prev != len;) {
+        prev = len;
+        len = rewrite_tail(code, len);
+    }
+
+    return len;
+}
+
+// Position of each label in a function's code, indexed from the lowest label it uses. Labels are
+// numbered in order across the program, so the range is dense.
+typedef struct {
+    size_t len;
+    size_t cap;
+    size_t *items;
+} Positions;
+
+static Positions label_at = {0};
+static long label_base = 0;
+
+static void index_labels(const Instrs *code) {
+    long lo = LONG_MAX;
+    long hi = LONG_MIN;
+    for (size_t i = 0; i < code->len; i++) {
+        const Instr *ins = &code->items[i];
+        if (ins->op == I_LABEL) {
+            lo = ins->arg < lo ? ins->arg : lo;
+            hi = ins->arg > hi ? ins->arg : hi;
+        }
+    }
+
+    label_base = lo;
+    label_at.len = 0;
+    for (long label = lo; label <= hi; label++) {
+        append(&label_at, code->len);
+    }
+    for (size_t i = 0; i < code->len; i++) {
+        if (code->items[i].op == I_LABEL) {
+            label_at.items[code->items[i].arg - lo] = i;
+        }
+    }
+}
+
+// Where a jump to label ends up once it has been followed through any unconditional jumps it lands
+// on. Chains are cut at the length of the code, so a loop of jumps can't hang.
+static long thread_target(const Instrs *code, long label) {
+    for (size_t steps = 0; steps < code->len; steps++) {
+        size_t i = label_at.items[label - label_base];
+        while (i < code->len && code->items[i].op == I_LABEL) {
+            i++;
+        }
+
+        const Instr *next = &code->items[i];
+        if (i == code->len || next->op != I_JMP || next->cond != J_ALWAYS || next->arg == label) {
+            break;
+        }
+        label = next->arg;
+    }
+
+    return label;
+}
+
+static void thread_jumps(Instrs *code) {
+    index_labels(code);
+    for (size_t i = 0; i < code->len; i++) {
+        Instr *ins = &code->items[i];
+        if (ins->op != I_JMP) {
+            continue;
+        }
+
+        long target = thread_target(code, ins->arg);
+        if (target != ins->arg) {
+            peephole.hits[P_THREAD]++;
+            ins->arg = target;
+        }
+    }
+
+    // jmp.cc lN; jmp lM; lN: -> jmp.!cc lM; lN:
+    size_t len = 0;
+    for (size_t i = 0; i < code->len; i++) {
+        Instr ins = code->items[i];
+        if (ins.op == I_JMP && ins.cond != J_ALWAYS && i + 2 < code->len) {
+            const Instr *over = &code->items[i + 1];
+            const Instr *next = &code->items[i + 2];
+            if (over->op == I_JMP && over->cond == J_ALWAYS && next->op == I_LABEL &&
+                next->arg == ins.arg) {
+                peephole.hits[P_THREAD]++;
+                ins.cond = jump_invert(ins.cond);
+                ins.arg = over->arg;
+                i++;
+            }
+        }
+
+        code->items[len++] = ins;
+    }
+    code->len = len;
+}
+
+// Returns whether any label was dropped
+static bool drop_dead_labels(Instrs *code) {
+    index_labels(code);
+
+    // A label's position is reused to mark that something jumps to it
+    for (size_t i = 0; i < code->len; i++) {
+        if (code->items[i].op == I_JMP) {
+            label_at.items[code->items[i].arg - label_base] = SIZE_MAX;
+        }
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < code->len; i++) {
+        Instr ins = code->items[i];
+        if (ins.op == I_LABEL && label_at.items[ins.arg - label_base] != SIZE_MAX) {
+            peephole.hits[P_DEAD_LABEL]++;
+            continue;
+        }
+
+        code->items[len++] = ins;
+    }
+
+    bool dropped = len != code->len;
+    code->len = len;
+
+    return dropped;
+}
+
+// Slots a function's code loads from, one flag each
+typedef struct {
+    size_t len;
+    size_t cap;
+    bool *items;
+} Flags;
+
+static Flags loaded = {0};
+
+static size_t slot_width(const char *ext) {
+    return strcmp(ext, ".d") == 0 ? 2 : 1;
+}
+
+static bool is_loaded(long slot, size_t width) {
+    for (size_t i = slot; i < slot + width; i++) {
+        if (i < loaded.len && loaded.items[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Stores to slots nothing loads from become pops, which the forward pass then folds into whatever
+// pushed the value. A tail call passes its arguments in the slots, so the code of a function with
+// one is left alone. Returns whether any store was dropped.
+static bool drop_dead_stores(Instrs *code) {
+    loaded.len = 0;
+    for (size_t i = 0; i < code->len; i++) {
+        const Instr *ins = &code->items[i];
+        if (ins->op == I_TAIL) {
+            return false;
+        }
+        if (ins->op != I_LOAD) {
+            continue;
+        }
+
+        size_t end = ins->arg + slot_width(ins->ext);
+        while (loaded.len < end) {
+            append(&loaded, false);
+        }
+        memset(&loaded.items[ins->arg], true, slot_width(ins->ext));
+    }
+
+    bool dropped = false;
+    for (size_t i = 0; i < code->len; i++) {
+        Instr *ins = &code->items[i];
+        if (ins->op == I_STORE && !is_loaded(ins->arg, slot_width(ins->ext))) {
+            peephole.hits[P_DEAD_STORE]++;
+            *ins = (Instr){.op = I_POP, .ext = ins->ext};
+            dropped = true;
+        }
+    }
+
+    return dropped;
+}
+
+// A single forward pass that rewrites the end of the output as each instruction is appended, so a
+// rewrite that exposes another pattern with earlier instructions is caught straight away.
+static void rewrite_forward(Instrs *code) {
+    size_t len = 0;
+    for (size_t i = 0; i < code->len; i++) {
+        Instr ins = code->items[i];
+
+        // Data directives aren't executed, they have to be kept for any reachable dataptr
+        if (peephole.enabled[P_UNREACHABLE] && len > 0 && ends_block(&code->items[len - 1]) &&
+            ins.op != I_LABEL && ins.op != I_FUNC && ins.op != I_DATA) {
+            peephole.hits[P_UNREACHABLE]++;
+            continue;
+        }
+
+        code->items[len++] = ins;
+        len = rewrite_settle(code->items, len);
+    }
+
+    code->len = len;
+}
+
+// Dropping a label can make the code after it unreachable, or leave a jump to the next
+// instruction, and a store that became a pop can cancel what pushed its value, so the forward pass
+// is repeated until no more labels or stores go
+void peephole_run(Instrs *code) {
+    if (peephole.enabled[P_THREAD]) {
+        thread_jumps(code);
+    }
+
+    bool again = true;
+    while (again) {
+        rewrite_forward(code);
+        again = peephole.enabled[P_DEAD_LABEL] && drop_dead_labels(code);
+        again = (peephole.enabled[P_DEAD_STORE] && drop_dead_stores(code)) || again;
+    }
+}
+
+void peephole_report(void) {
+    for (size_t i = 0; i < P_COUNT; i++) {
+        fprintf(stderr, "peephole %s: %zu\n", peephole_names[i], peephole.hits[i]);
+    }
+}
+
+static void emit_label(Emitter *e, long label) {
+    emit_char(e, 'l');
+    emit_long(e, label);
+}
+
+void ir_emit(Emitter *e, const Instrs *code) {
+    for (size_t i = 0; i < code->len; i++) {
+        const Instr *ins = &code->items[i];
+
+        switch (ins->op) {
+        case I_PUSH:
+        case I_LOAD:
+        case I_STORE:
+            emit_str(e, op_names[ins->op]);
+            emit_str(e, ins->ext);
+            emit_char(e, ' ');
+            emit_long(e, ins->arg);
+            break;
+        case I_PUSH_CHAR:
+            emit_str(e, op_names[ins->op]);
+            emit_str(e, ins->ext);
+            emit_str(e, " '");
+            emit_view(e, &ins->text);
+            emit_char(e, '\'');
+            break;
+        case I_DUP:
+        case I_POP:
+        case I_ADD:
+        case I_SUB:
+        case I_MUL:
+        case I_DIV:
+        case I_CMP:
+        case I_RET:
+            emit_str(e, op_names[ins->op]);
+            emit_str(e, ins->ext);
+            break;
+        case I_JMP:
+            emit_str(e, "jmp");
+            if (ins->cond != J_ALWAYS) {
+                emit_char(e, '.');
+                emit_str(e, cond_names[ins->cond]);
+            }
+            emit_char(e, ' ');
+            emit_label(e, ins->arg);
+            break;
+        case I_LABEL:
+            emit_label(e, ins->arg);
+            emit_char(e, ':');
+            break;
+        case I_CALL:
+            emit_str(e, "call ");
+            emit_atom(e, ins->name);
+            break;
+        case I_TAIL:
+            emit_str(e, "jmp ");
+            emit_atom(e, ins->name);
+            break;
+        case I_FUNC:
+            emit_atom(e, ins->name);
+            emit_char(e, ':');
+            break;
+        case I_DATA:
+            emit_str(e, ".data s");
+            emit_long(e, ins->arg);
+            emit_str(e, " .string \"");
+            emit_view(e, &ins->text);
+            emit_char(e, '"');
+            break;
+        case I_DATAPTR:
+            emit_str(e, "dataptr s");
+            emit_long(e, ins->arg);
+            break;
+        }
+
+        emit_char(e, '\n');
+    }
+}
@@ -4,27 +4,155 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "arena.h"
+#include "emit.h"
 #include "gen.h"
+#include "ir.h"
+#include "opt.h"
 #include "parse.h"
 #include "str.h"
 #include "token.h"
 
-int main() {
-    int fd = open("examples/string", O_RDONLY);
-    if (fd == -1) {
-        fprintf(stderr, "open: %s", strerror(errno));
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-stats] [-lex] [-O0] [-o out] [-peep rewrites] [-inline cost] [-clones n] "
+            "[file]\n",
+            prog);
+    exit(1);
+}
+
+static bool parse_count(const char *arg, size_t *count) {
+    char *end;
+    if (!isdigit((unsigned char)arg[0])) {
+        return false;
+    }
+    *count = strtoul(arg, &end, 10);
+
+    return *end == '\0';
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Lexer benchmark: tokenise the whole input and report throughput instead of compiling
+static void bench_lex(Lexer *lexer) {
+    double start = now();
+
+    size_t ntokens = 0;
+    Token tok;
+    while (lex_token(lexer, &tok)) {
+        ntokens++;
+    }
+    size_t nbytes = lexer->offset + lexer->position;
+
+    double secs = now() - start;
+    fprintf(stderr, "lexed %zu tokens, %zu bytes in %.3fms (%.1f MB/s)\n", ntokens, nbytes,
+            secs * 1e3, nbytes / secs / 1e6);
+}
+
+int main(int argc, char **argv) {
+    const char *path = nullptr;
+    const char *outpath = nullptr;
+    bool stats = false;
+    bool lex_only = false;
+    bool optimize = true;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "-lex") == 0) {
+            lex_only = true;
+        } else if (strcmp(argv[i], "-O0") == 0) {
+            optimize = false;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            if (++i == argc) {
+                usage(argv[0]);
+            }
+            outpath = argv[i];
+        } else if (strcmp(argv[i], "-peep") == 0) {
+            if (++i == argc || !peephole_parse(argv[i])) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "-inline") == 0) {
+            if (++i == argc || !parse_count(argv[i], &inlining.threshold)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "-clones") == 0) {
+            if (++i == argc || !parse_count(argv[i], &cloning.budget)) {
+                usage(argv[0]);
+            }
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            usage(argv[0]);
+        } else if (path == nullptr) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    // With no file, or "-", the source is read from stdin
+    int fd = STDIN_FILENO;
+    if (path != nullptr && strcmp(path, "-") != 0) {
+        fd = open(path, O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "open %s: %s", path, strerror(errno));
+            exit(1);
+        }
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        fprintf(stderr, "fstat: %s", strerror(errno));
         exit(1);
     }
 
-    String src = string_from_file(fd);
-    Tokens tokens = tokenise(&src);
+    // Regular files are loaded whole. Pipes, FIFOs and sockets are streamed so the compiler can sit
+    // at the end of a generator without a temp file.
+    // The lexer reads from src and finds line numbers in it, so it is kept alive until parsing is
+    // done
+    String src = {0};
+    Lexer lexer;
+    if (S_ISREG(st.st_mode)) {
+        src = string_from_file(fd);
+        lexer = lexer_from_string(&src);
+    } else {
+        lexer = lexer_from_fd(fd);
+    }
+
+    if (lex_only) {
+        bench_lex(&lexer);
+        return 0;
+    }
 
-    TokenIter ts = {.array = tokens, .position = 0};
+    TokenIter ts = token_iter(&lexer);
     Program prg = parse_program(&ts);
+    // Optimizing must not change which programs are accepted, so they are checked first
+    if (optimize) {
+        gen_check(&prg);
+        opt_program(&prg);
+    }
 
+    emit_open(&out, outpath);
     gen_program(&prg);
+    emit_close(&out);
+    string_close(&src);
+
+    if (stats) {
+        fprintf(stderr, "allocations: %zu (%zu bytes)\n", alloc_stats.mallocs, alloc_stats.bytes);
+        fprintf(stderr, "arena: %zu allocations in %zu chunks\n", arena.allocs, arena.chunks);
+        fprintf(stderr, "inlined: %zu call sites\n", inlining.sites);
+        fprintf(stderr, "specialized: %zu clones\n", cloning.clones);
+        peephole_report();
+    }
+
+    arena_free(&arena);
 
     return 0;
 }
@@ -0,0 +1,2647 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "map.h"
+#include "opt.h"
+
+// Declared types of a function's variables, flat like the code generator's scoped_symbols
+typedef struct {
+    Atom key;
+    Type type;
+} Local;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    uint32_t generation;
+    MapSlot *slots;
+    Local *items;
+} LocalMap;
+
+// Numbers names: functions by their index in Program.funcs, locals densely for bit sets
+typedef struct {
+    Atom key;
+    uint32_t index;
+} Index;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    uint32_t generation;
+    MapSlot *slots;
+    Index *items;
+} IndexMap;
+
+static Program *program = nullptr;
+static LocalMap locals = {0};
+static IndexMap functions = {0};
+
+static int type_bits(const Type *type) {
+    if (type->pointer || type->name == A_LONG) {
+        return 64;
+    }
+    if (type->name == A_BYTE) {
+        return 8;
+    }
+
+    return 32;
+}
+
+static bool is_int(const Type *type) {
+    return type->name == A_INT && !type->pointer;
+}
+
+// Truncate to the width of the type the machine computes in, sign extending back to a long
+static long wrap(uint64_t v, int bits) {
+    if (bits == 64) {
+        return (long)v;
+    }
+
+    uint64_t sign = 1ULL << (bits - 1);
+    uint64_t mask = (1ULL << bits) - 1;
+
+    return (long)(((v & mask) ^ sign) - sign);
+}
+
+static bool is_number(ExprId id, long *value) {
+    const Expr *expr = expr_at(program, id);
+    if (expr->kind != E_VALUE || expr->value.v.kind != V_NUMBER) {
+        return false;
+    }
+
+    if (value != nullptr) {
+        *value = expr->value.v.value.num;
+    }
+
+    return true;
+}
+
+static void set_number(ExprId id, long value) {
+    Expr *expr = expr_at(program, id);
+    expr->kind = E_VALUE;
+    expr->value.v = (ValueExpr){.kind = V_NUMBER, .value.num = value};
+}
+
+// Comparisons and logical operators, whose result is 0 or 1
+static bool is_boolean_op(BinaryOp op) {
+    return op >= OP_LT && op <= OP_LOR;
+}
+
+// Whether the expression only ever evaluates to 0 or 1
+static bool is_boolean(ExprId id) {
+    long value;
+    if (is_number(id, &value)) {
+        return value == 0 || value == 1;
+    }
+
+    const Expr *expr = expr_at(program, id);
+
+    return expr->kind == E_BINARY_OP && is_boolean_op(expr->value.b.op);
+}
+
+// Whether evaluating the expression can have no effect other than its value
+static bool is_pure(ExprId id) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+    case E_IDENT:
+        return true;
+    case E_BINARY_OP:
+        return is_pure(expr->value.b.left) && is_pure(expr->value.b.right);
+    case E_CALL:
+        return false;
+    }
+
+    return false;
+}
+
+// The width an expression is computed in when nothing around it decides: the type of its first
+// variable or call, as the code generator infers it, defaulting to int.
+static int expr_bits(ExprId id) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+        return expr->value.v.kind == V_STRING ? 64 : 0;
+    case E_IDENT: {
+        Local *local = get(&locals, expr->value.id.name);
+        return local != nullptr ? type_bits(&local->type) : 0;
+    }
+    case E_CALL: {
+        Index *fn = get(&functions, expr->value.c.name);
+        return fn != nullptr ? type_bits(&program->funcs.items[fn->index].decl.type) : 0;
+    }
+    case E_BINARY_OP: {
+        int bits = expr_bits(expr->value.b.left);
+        return bits != 0 ? bits : expr_bits(expr->value.b.right);
+    }
+    }
+
+    return 0;
+}
+
+static int context_bits(ExprId id) {
+    int bits = expr_bits(id);
+
+    return bits != 0 ? bits : 32;
+}
+
+static bool fold_arith(BinaryOp op, long l, long r, int bits, long *result) {
+    l = wrap(l, bits);
+    r = wrap(r, bits);
+    uint64_t a = l;
+    uint64_t b = r;
+
+    switch (op) {
+    case OP_ADD:
+        *result = wrap(a + b, bits);
+        return true;
+    case OP_SUB:
+        *result = wrap(a - b, bits);
+        return true;
+    case OP_MUL:
+        *result = wrap(a * b, bits);
+        return true;
+    case OP_DIV:
+        // Left for the machine to trap on, as is the one overflowing division
+        if (r == 0 || (r == -1 && l == wrap(1ULL << (bits - 1), bits))) {
+            return false;
+        }
+        *result = wrap(l / r, bits);
+        return true;
+    case OP_LT:
+        *result = l < r;
+        return true;
+    case OP_LE:
+        *result = l <= r;
+        return true;
+    case OP_GT:
+        *result = l > r;
+        return true;
+    case OP_GE:
+        *result = l >= r;
+        return true;
+    case OP_EQY:
+        *result = l == r;
+        return true;
+    case OP_NEQY:
+        *result = l != r;
+        return true;
+    case OP_LAND:
+        *result = l != 0 && r != 0;
+        return true;
+    case OP_LOR:
+        *result = l != 0 || r != 0;
+        return true;
+    }
+
+    return false;
+}
+
+static void fold_expr(ExprId id, int bits);
+
+// && and || with one literal operand. The left operand always runs, the right only when the left
+// doesn't decide, so a literal on the right can only stand in for a pure left operand.
+static void fold_logical(ExprId id, const BinaryOpExpr *bop) {
+    bool decides = bop->op == OP_LOR;
+    long value;
+
+    if (is_number(bop->left, &value)) {
+        if ((value != 0) == decides) {
+            set_number(id, decides);
+        } else if (is_boolean(bop->right)) {
+            *expr_at(program, id) = *expr_at(program, bop->right);
+        }
+    } else if (is_number(bop->right, &value)) {
+        if ((value != 0) != decides && is_boolean(bop->left)) {
+            *expr_at(program, id) = *expr_at(program, bop->left);
+        } else if ((value != 0) == decides && is_pure(bop->left)) {
+            set_number(id, decides);
+        }
+    }
+}
+
+static void fold_expr(ExprId id, int bits) {
+    Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+    case E_IDENT:
+        break;
+    case E_CALL: {
+        CallExpr *call = &expr->value.c;
+        for (size_t i = 0; i < call->args.len; i++) {
+            ExprId arg = list_at(program, &call->args, i);
+            fold_expr(arg, context_bits(arg));
+        }
+        break;
+    }
+    case E_BINARY_OP: {
+        BinaryOpExpr bop = expr->value.b;
+
+        // Comparisons compute in their operands' width rather than their result's, and each operand
+        // of && and || is a condition of its own
+        int opbits = is_boolean_op(bop.op) ? context_bits(id) : bits;
+        if (bop.op == OP_LAND || bop.op == OP_LOR) {
+            fold_expr(bop.left, context_bits(bop.left));
+            fold_expr(bop.right, context_bits(bop.right));
+        } else {
+            fold_expr(bop.left, opbits);
+            fold_expr(bop.right, opbits);
+        }
+
+        long l, r, result;
+        if (is_number(bop.left, &l) && is_number(bop.right, &r)) {
+            if (fold_arith(bop.op, l, r, opbits, &result)) {
+                set_number(id, result);
+            }
+        } else if (bop.op == OP_LAND || bop.op == OP_LOR) {
+            fold_logical(id, &bop);
+        }
+        break;
+    }
+    }
+}
+
+// Replace each if statement with a constant condition in the block by its body. Names are unique
+// once scopes are resolved, so the body's variables can't clash with the block's. The block grows,
+// so like one an inlined call is expanded into, it is rebuilt at the end of the statements.
+static void splice_taken(Block *block) {
+    Statements stmts = {0};
+    for (size_t i = 0; i < block->len; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+        if (stmt->kind == S_IF && is_number(stmt->value.i.expr, nullptr)) {
+            const Block *body = &stmt->value.i.stmts;
+            append_n(&stmts, &program->stmts.items[body->start], body->len);
+        } else {
+            append(&stmts, *stmt);
+        }
+    }
+
+    block->start = program->stmts.len;
+    block->len = stmts.len;
+    append_n(&program->stmts, stmts.items, stmts.len);
+    free(stmts.items);
+}
+
+static void fold_block(Block *block, const Type *fntype) {
+    size_t len = 0;
+    bool taken = false;
+    for (size_t i = 0; i < block->len; i++) {
+        Statement *stmt = stmt_at(program, block, i);
+        long value;
+
+        switch (stmt->kind) {
+        case S_DEFINITION: {
+            DefinitionStatement *def = &stmt->value.d;
+            Local local = {.key = def->decl.name, .type = def->decl.type};
+            insert(&locals, local);
+            fold_expr(def->expr, type_bits(&def->decl.type));
+            break;
+        }
+        case S_ASSIGN: {
+            AssignStatement *asn = &stmt->value.a;
+            Local *local = get(&locals, asn->name);
+            fold_expr(asn->expr, local != nullptr ? type_bits(&local->type) : 32);
+            break;
+        }
+        case S_EXPR:
+            fold_expr(stmt->value.e.expr, context_bits(stmt->value.e.expr));
+            break;
+        case S_IF:
+            fold_expr(stmt->value.i.expr, context_bits(stmt->value.i.expr));
+            fold_block(&stmt->value.i.stmts, fntype);
+
+            // A branch that is never taken is dropped along with its condition, one that always is
+            // is replaced by its body below
+            if (is_number(stmt->value.i.expr, &value)) {
+                if (value == 0) {
+                    continue;
+                }
+                taken = true;
+            }
+            break;
+        case S_WHILE:
+            fold_expr(stmt->value.w.expr, context_bits(stmt->value.w.expr));
+            fold_block(&stmt->value.w.stmts, fntype);
+
+            if (is_number(stmt->value.w.expr, &value) && value == 0) {
+                continue;
+            }
+            break;
+        case S_RETURN:
+            if (stmt->value.r.expr != NO_EXPR) {
+                fold_expr(stmt->value.r.expr, type_bits(fntype));
+            }
+            break;
+        }
+
+        program->stmts.items[block->start + len++] = *stmt;
+    }
+
+    block->len = len;
+    if (taken) {
+        splice_taken(block);
+    }
+}
+
+void fold_function(Program *prg, Function *func) {
+    program = prg;
+
+    clear(&locals);
+    for (size_t i = 0; i < func->args.len; i++) {
+        Local local = {.key = func->args.items[i].name, .type = func->args.items[i].type};
+        insert(&locals, local);
+    }
+
+    fold_block(&func->stmts, &func->decl.type);
+}
+
+/* Propagation */
+
+typedef enum { F_CONST, F_COPY } FactKind;
+
+// What is known about a variable at a point in the function: it holds a constant, or the same value
+// as another variable. A copy only holds while its source hasn't been assigned since, so the
+// source's assignment stamp is recorded with it.
+typedef struct {
+    Atom key;
+    FactKind kind;
+    long value;
+    Atom source;
+    uint32_t stamp;
+} Fact;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    uint32_t generation;
+    MapSlot *slots;
+    Fact *items;
+} Facts;
+
+// Bumped every time a variable is assigned, in the order statements are visited
+typedef struct {
+    Atom key;
+    uint32_t stamp;
+} Stamp;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    uint32_t generation;
+    MapSlot *slots;
+    Stamp *items;
+} Stamps;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    Atom *items;
+} Atoms;
+
+static Stamps stamps = {0};
+static uint32_t next_stamp = 0;
+
+static uint32_t stamp_of(Atom name) {
+    Stamp *stamp = get(&stamps, name);
+
+    return stamp != nullptr ? stamp->stamp : 0;
+}
+
+static void bump_stamp(Atom name) {
+    Stamp stamp = {.key = name, .stamp = ++next_stamp};
+    insert(&stamps, stamp);
+}
+
+static void facts_copy(Facts *dst, const Facts *src) {
+    mapfree(dst);
+    if (src->cap == 0) {
+        return;
+    }
+
+    dst->cap = src->cap;
+    dst->len = src->len;
+    dst->generation = src->generation;
+    dst->items = map_alloc(src->cap, sizeof(Fact));
+    dst->slots = map_alloc(src->cap, sizeof(MapSlot));
+    memcpy(dst->items, src->items, src->cap * sizeof(Fact));
+    memcpy(dst->slots, src->slots, src->cap * sizeof(MapSlot));
+}
+
+// Keep only the facts that hold on both paths into a join
+static void facts_meet(Facts *facts, const Facts *other) {
+    Atoms drop = {0};
+    for (size_t i = 0; i < facts->cap; i++) {
+        if (facts->slots[i].generation != facts->generation) {
+            continue;
+        }
+
+        Fact *fact = &facts->items[i];
+        Fact *theirs = get(other, fact->key);
+        if (theirs == nullptr || theirs->kind != fact->kind || theirs->value != fact->value ||
+            theirs->source != fact->source || theirs->stamp != fact->stamp) {
+            append(&drop, fact->key);
+        }
+    }
+
+    for (size_t i = 0; i < drop.len; i++) {
+        erase(facts, drop.items[i]);
+    }
+    arrayfree(&drop);
+}
+
+// Forget the variables defined in a block as it ends, along with any copy of one of them, since
+// the names are out of scope after it
+static void facts_leave(Facts *facts, const Block *block) {
+    Atoms drop = {0};
+    for (size_t i = 0; i < block->len; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+        if (stmt->kind == S_DEFINITION) {
+            append(&drop, stmt->value.d.decl.name);
+        }
+    }
+
+    size_t defined = drop.len;
+    for (size_t i = 0; i < facts->cap && defined > 0; i++) {
+        if (facts->slots[i].generation != facts->generation || facts->items[i].kind != F_COPY) {
+            continue;
+        }
+
+        for (size_t j = 0; j < defined; j++) {
+            if (facts->items[i].source == drop.items[j]) {
+                append(&drop, facts->items[i].key);
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < drop.len; i++) {
+        erase(facts, drop.items[i]);
+    }
+    arrayfree(&drop);
+}
+
+// Variables assigned or defined anywhere in a block, nested blocks included
+static void assigned_in(const Block *block, Atoms *names) {
+    for (size_t i = 0; i < block->len; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+
+        switch (stmt->kind) {
+        case S_DEFINITION:
+            append(names, stmt->value.d.decl.name);
+            break;
+        case S_ASSIGN:
+            append(names, stmt->value.a.name);
+            break;
+        case S_IF:
+            assigned_in(&stmt->value.i.stmts, names);
+            break;
+        case S_WHILE:
+            assigned_in(&stmt->value.w.stmts, names);
+            break;
+        case S_EXPR:
+        case S_RETURN:
+            break;
+        }
+    }
+}
+
+// Replace variables with what is known about them. Only int variables are replaced by constants,
+// since a literal is typed as int wherever it appears.
+static void propagate_expr(const Facts *facts, ExprId id) {
+    Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+        break;
+    case E_IDENT: {
+        // A copy of a copy is resolved when the fact is made, so one lookup is enough
+        Fact *fact = get(facts, expr->value.id.name);
+        if (fact == nullptr) {
+            break;
+        }
+
+        if (fact->kind == F_CONST) {
+            set_number(id, fact->value);
+        } else if (stamp_of(fact->source) == fact->stamp) {
+            expr->value.id.name = fact->source;
+        }
+        break;
+    }
+    case E_BINARY_OP:
+        propagate_expr(facts, expr->value.b.left);
+        propagate_expr(facts, expr->value.b.right);
+        break;
+    case E_CALL:
+        for (size_t i = 0; i < expr->value.c.args.len; i++) {
+            propagate_expr(facts, list_at(program, &expr->value.c.args, i));
+        }
+        break;
+    }
+}
+
+static bool same_type(const Type *a, const Type *b) {
+    return a->name == b->name && a->pointer == b->pointer;
+}
+
+// Record what an assignment of `id` to `name` makes known
+static void propagate_assign(Facts *facts, Atom name, ExprId id) {
+    bump_stamp(name);
+    erase(facts, name);
+
+    Local *local = get(&locals, name);
+    if (local == nullptr) {
+        return;
+    }
+
+    long value;
+    const Expr *expr = expr_at(program, id);
+    if (is_number(id, &value) && local->type.name == A_INT && !local->type.pointer) {
+        Fact fact = {.key = name, .kind = F_CONST, .value = wrap(value, 32)};
+        insert(facts, fact);
+    } else if (expr->kind == E_IDENT && expr->value.id.name != name) {
+        Atom source = expr->value.id.name;
+        Local *from = get(&locals, source);
+        if (from != nullptr && same_type(&from->type, &local->type)) {
+            Fact fact = {.key = name, .kind = F_COPY, .source = source, .stamp = stamp_of(source)};
+            insert(facts, fact);
+        }
+    }
+}
+
+static void propagate_block(Facts *facts, const Block *block, const Type *fntype) {
+    for (size_t i = 0; i < block->len; i++) {
+        Statement *stmt = stmt_at(program, block, i);
+
+        switch (stmt->kind) {
+        case S_DEFINITION: {
+            DefinitionStatement *def = &stmt->value.d;
+            propagate_expr(facts, def->expr);
+            fold_expr(def->expr, type_bits(&def->decl.type));
+
+            Local local = {.key = def->decl.name, .type = def->decl.type};
+            insert(&locals, local);
+            propagate_assign(facts, def->decl.name, def->expr);
+            break;
+        }
+        case S_ASSIGN: {
+            AssignStatement *asn = &stmt->value.a;
+            Local *local = get(&locals, asn->name);
+            propagate_expr(facts, asn->expr);
+            fold_expr(asn->expr, local != nullptr ? type_bits(&local->type) : 32);
+            propagate_assign(facts, asn->name, asn->expr);
+            break;
+        }
+        case S_EXPR:
+            propagate_expr(facts, stmt->value.e.expr);
+            fold_expr(stmt->value.e.expr, context_bits(stmt->value.e.expr));
+            break;
+        case S_RETURN:
+            if (stmt->value.r.expr != NO_EXPR) {
+                propagate_expr(facts, stmt->value.r.expr);
+                fold_expr(stmt->value.r.expr, type_bits(fntype));
+            }
+            break;
+        case S_IF: {
+            IfStatement *ifs = &stmt->value.i;
+            propagate_expr(facts, ifs->expr);
+            fold_expr(ifs->expr, context_bits(ifs->expr));
+
+            long value;
+            bool known = is_number(ifs->expr, &value);
+            if (known && value == 0) {
+                break;
+            }
+
+            Facts taken = {0};
+            facts_copy(&taken, facts);
+            propagate_block(&taken, &ifs->stmts, fntype);
+            if (known) {
+                facts_copy(facts, &taken);
+            } else {
+                facts_meet(facts, &taken);
+            }
+            mapfree(&taken);
+            break;
+        }
+        case S_WHILE: {
+            // Nothing assigned in the loop is known at its head, since the back edge may change it.
+            // Stamping those variables also stales any copy of them made before the loop.
+            WhileStatement *ws = &stmt->value.w;
+            Atoms names = {0};
+            assigned_in(&ws->stmts, &names);
+            for (size_t j = 0; j < names.len; j++) {
+                bump_stamp(names.items[j]);
+                erase(facts, names.items[j]);
+            }
+            arrayfree(&names);
+
+            propagate_expr(facts, ws->expr);
+            fold_expr(ws->expr, context_bits(ws->expr));
+
+            Facts body = {0};
+            facts_copy(&body, facts);
+            propagate_block(&body, &ws->stmts, fntype);
+            mapfree(&body);
+            break;
+        }
+        }
+    }
+
+    facts_leave(facts, block);
+}
+
+void propagate_function(Program *prg, Function *func) {
+    program = prg;
+
+    clear(&locals);
+    clear(&stamps);
+    for (size_t i = 0; i < func->args.len; i++) {
+        Local local = {.key = func->args.items[i].name, .type = func->args.items[i].type};
+        insert(&locals, local);
+    }
+
+    Facts facts = {0};
+    propagate_block(&facts, &func->stmts, &func->decl.type);
+    mapfree(&facts);
+}
+
+/* Liveness */
+
+// A set of locals, one bit each as numbered in local_index
+typedef struct {
+    uint64_t *words;
+} LiveSet;
+
+static IndexMap local_index = {0};
+static size_t live_words = 0;
+
+static LiveSet live_new(const LiveSet *from) {
+    LiveSet set = {.words = map_alloc(live_words, sizeof(uint64_t))};
+    if (from != nullptr) {
+        memcpy(set.words, from->words, live_words * sizeof(uint64_t));
+    }
+
+    return set;
+}
+
+static void live_free(LiveSet *set) {
+    free(set->words);
+    set->words = nullptr;
+}
+
+static void live_union(LiveSet *set, const LiveSet *other) {
+    for (size_t i = 0; i < live_words; i++) {
+        set->words[i] |= other->words[i];
+    }
+}
+
+static bool live_equal(const LiveSet *a, const LiveSet *b) {
+    return memcmp(a->words, b->words, live_words * sizeof(uint64_t)) == 0;
+}
+
+// Names that aren't locals, like undeclared variables, are never tracked
+static bool live_has(const LiveSet *set, Atom name) {
+    Index *local = get(&local_index, name);
+
+    return local == nullptr || (set->words[local->index / 64] >> (local->index % 64)) & 1;
+}
+
+static void live_set(LiveSet *set, Atom name, bool live) {
+    Index *local = get(&local_index, name);
+    if (local == nullptr) {
+        return;
+    }
+
+    uint64_t bit = 1ULL << (local->index % 64);
+    if (live) {
+        set->words[local->index / 64] |= bit;
+    } else {
+        set->words[local->index / 64] &= ~bit;
+    }
+}
+
+static void live_uses(LiveSet *set, ExprId id) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+        break;
+    case E_IDENT:
+        live_set(set, expr->value.id.name, true);
+        break;
+    case E_BINARY_OP:
+        live_uses(set, expr->value.b.left);
+        live_uses(set, expr->value.b.right);
+        break;
+    case E_CALL:
+        for (size_t i = 0; i < expr->value.c.args.len; i++) {
+            live_uses(set, list_at(program, &expr->value.c.args, i));
+        }
+        break;
+    }
+}
+
+static void number_locals(const Block *block) {
+    for (size_t i = 0; i < block->len; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+
+        if (stmt->kind == S_DEFINITION && get(&local_index, stmt->value.d.decl.name) == nullptr) {
+            Index local = {.key = stmt->value.d.decl.name, .index = local_index.len};
+            insert(&local_index, local);
+        } else if (stmt->kind == S_IF) {
+            number_locals(&stmt->value.i.stmts);
+        } else if (stmt->kind == S_WHILE) {
+            number_locals(&stmt->value.w.stmts);
+        }
+    }
+}
+
+static bool expr_reads(ExprId id, Atom name) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+        return false;
+    case E_IDENT:
+        return expr->value.id.name == name;
+    case E_BINARY_OP:
+        return expr_reads(expr->value.b.left, name) || expr_reads(expr->value.b.right, name);
+    case E_CALL:
+        for (size_t i = 0; i < expr->value.c.args.len; i++) {
+            if (expr_reads(list_at(program, &expr->value.c.args, i), name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    return false;
+}
+
+// Whether the statement reads or assigns name, here or in a nested block
+static bool mentions(const Statement *stmt, Atom name) {
+    const Block *body = nullptr;
+    ExprId expr = NO_EXPR;
+
+    switch (stmt->kind) {
+    case S_DEFINITION:
+        expr = stmt->value.d.expr;
+        break;
+    case S_ASSIGN:
+        if (stmt->value.a.name == name) {
+            return true;
+        }
+        expr = stmt->value.a.expr;
+        break;
+    case S_EXPR:
+        expr = stmt->value.e.expr;
+        break;
+    case S_RETURN:
+        expr = stmt->value.r.expr;
+        break;
+    case S_IF:
+        expr = stmt->value.i.expr;
+        body = &stmt->value.i.stmts;
+        break;
+    case S_WHILE:
+        expr = stmt->value.w.expr;
+        body = &stmt->value.w.stmts;
+        break;
+    }
+
+    if (expr != NO_EXPR && expr_reads(expr, name)) {
+        return true;
+    }
+    for (size_t i = 0; body != nullptr && i < body->len; i++) {
+        if (mentions(stmt_at(program, body, i), name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// A definition whose value is never read moves down to the variable's first assignment, if that is
+// the next statement in the block to mention it, so the dead value is never stored. A call in the
+// initializer stays where it was as an expression statement. With no later mention at all, only
+// the call is left.
+static void sink_definition(Block *block, size_t i, bool *keep) {
+    Statement *stmt = stmt_at(program, block, i);
+    Atom name = stmt->value.d.decl.name;
+    ExprId expr = stmt->value.d.expr;
+
+    size_t j = i + 1;
+    while (j < block->len && !(keep[j] && mentions(stmt_at(program, block, j), name))) {
+        j++;
+    }
+
+    if (j < block->len) {
+        Statement *next = stmt_at(program, block, j);
+        if (next->kind != S_ASSIGN || next->value.a.name != name) {
+            return;
+        }
+
+        DefinitionStatement def = {.decl = stmt->value.d.decl, .expr = next->value.a.expr};
+        next->kind = S_DEFINITION;
+        next->value.d = def;
+    }
+
+    if (is_pure(expr)) {
+        keep[i] = false;
+    } else {
+        stmt->kind = S_EXPR;
+        stmt->value.e.expr = expr;
+    }
+}
+
+// Whether the definition at i is only read by the assignment right after it, which copies it to a
+// variable of the same type, so the assignment can take the definition's value instead. Types are
+// those fold_function recorded in locals.
+static bool copied_once(const Block *block, size_t i, const bool *keep, const bool *last_copy) {
+    if (i + 1 == block->len || !keep[i + 1] || !last_copy[i + 1]) {
+        return false;
+    }
+
+    const Statement *def = stmt_at(program, block, i);
+    const Statement *next = stmt_at(program, block, i + 1);
+    if (expr_at(program, next->value.a.expr)->value.id.name != def->value.d.decl.name) {
+        return false;
+    }
+
+    Local *local = get(&locals, next->value.a.name);
+    return local != nullptr && same_type(&local->type, &def->value.d.decl.type);
+}
+
+// Walk a block backwards. On entry live holds the locals live after the block, on return those live
+// before it. With mutate set, assignments whose value is never read are removed, as long as
+// computing the value has no effect, and a lone call is kept as an expression statement. A
+// definition only read by a copy right after it hands its value to the copy. One whose value is
+// dead contributes no uses, and is sunk once the whole block is known.
+static void live_block(Block *block, LiveSet *live, bool mutate) {
+    bool *keep = mutate ? map_alloc(block->len, sizeof(bool)) : nullptr;
+    bool *dead = mutate ? map_alloc(block->len, sizeof(bool)) : nullptr;
+    bool *last_copy = mutate ? map_alloc(block->len, sizeof(bool)) : nullptr;
+
+    for (size_t i = block->len; i-- > 0;) {
+        Statement *stmt = stmt_at(program, block, i);
+        bool kept = true;
+
+        switch (stmt->kind) {
+        case S_DEFINITION:
+        case S_ASSIGN: {
+            bool def = stmt->kind == S_DEFINITION;
+            Atom name = def ? stmt->value.d.decl.name : stmt->value.a.name;
+            ExprId expr = def ? stmt->value.d.expr : stmt->value.a.expr;
+
+            bool unread = !live_has(live, name);
+            if (mutate && def) {
+                dead[i] = unread && (is_pure(expr) || expr_at(program, expr)->kind == E_CALL);
+            }
+            if (unread && is_pure(expr)) {
+                kept = def;
+                break;
+            }
+            if (mutate && unread && !def && expr_at(program, expr)->kind == E_CALL) {
+                stmt->kind = S_EXPR;
+                stmt->value.e.expr = expr;
+            }
+            if (mutate && def && copied_once(block, i, keep, last_copy)) {
+                stmt_at(program, block, i + 1)->value.a.expr = expr;
+                kept = false;
+            }
+
+            const Expr *value = expr_at(program, expr);
+            if (mutate && !def) {
+                last_copy[i] = value->kind == E_IDENT && !live_has(live, value->value.id.name);
+            }
+
+            live_set(live, name, false);
+            live_uses(live, expr);
+            break;
+        }
+        case S_EXPR:
+            // Its value is discarded, so without a call it does nothing. Its names and types were
+            // checked along with the rest of the program before optimizing, so dropping it can't
+            // hide an error.
+            if (is_pure(stmt->value.e.expr)) {
+                kept = false;
+                break;
+            }
+            live_uses(live, stmt->value.e.expr);
+            break;
+        case S_RETURN:
+            memset(live->words, 0, live_words * sizeof(uint64_t));
+            if (stmt->value.r.expr != NO_EXPR) {
+                live_uses(live, stmt->value.r.expr);
+            }
+            break;
+        case S_IF: {
+            IfStatement *ifs = &stmt->value.i;
+            LiveSet body = live_new(live);
+            live_block(&ifs->stmts, &body, mutate);
+            live_union(live, &body);
+            live_free(&body);
+
+            if (ifs->stmts.len == 0 && is_pure(ifs->expr)) {
+                kept = false;
+                break;
+            }
+            live_uses(live, ifs->expr);
+            break;
+        }
+        case S_WHILE: {
+            // What is live at the loop head is live after the loop, used by the condition, or live
+            // into the body. The body's live-in depends on the head, so iterate to a fixed point.
+            WhileStatement *ws = &stmt->value.w;
+            LiveSet head = live_new(live);
+            live_uses(&head, ws->expr);
+            while (true) {
+                LiveSet next = live_new(&head);
+                live_block(&ws->stmts, &next, false);
+                live_union(&next, &head);
+
+                bool done = live_equal(&next, &head);
+                live_free(&head);
+                head = next;
+                if (done) {
+                    break;
+                }
+            }
+
+            if (mutate) {
+                LiveSet body = live_new(&head);
+                live_block(&ws->stmts, &body, true);
+                live_free(&body);
+            }
+
+            live_free(live);
+            *live = head;
+            break;
+        }
+        }
+
+        if (mutate) {
+            keep[i] = kept;
+        }
+    }
+
+    if (mutate) {
+        for (size_t i = 0; i < block->len; i++) {
+            if (dead[i]) {
+                sink_definition(block, i, keep);
+            }
+        }
+
+        size_t len = 0;
+        for (size_t i = 0; i < block->len; i++) {
+            if (keep[i]) {
+                program->stmts.items[block->start + len++] = *stmt_at(program, block, i);
+            }
+        }
+        block->len = len;
+        free(keep);
+        free(dead);
+        free(last_copy);
+    }
+}
+
+// Variables that are still read or assigned anywhere in the function
+static void referenced_in(const Block *block, LiveSet *refs) {
+    for (size_t i = 0; i < block->len; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+
+        switch (stmt->kind) {
+        case S_DEFINITION:
+            live_uses(refs, stmt->value.d.expr);
+            break;
+        case S_ASSIGN:
+            live_set(refs, stmt->value.a.name, true);
+            live_uses(refs, stmt->value.a.expr);
+            break;
+        case S_EXPR:
+            live_uses(refs, stmt->value.e.expr);
+            break;
+        case S_RETURN:
+            if (stmt->value.r.expr != NO_EXPR) {
+                live_uses(refs, stmt->value.r.expr);
+            }
+            break;
+        case S_IF:
+            live_uses(refs, stmt->value.i.expr);
+            referenced_in(&stmt->value.i.stmts, refs);
+            break;
+        case S_WHILE:
+            live_uses(refs, stmt->value.w.expr);
+            referenced_in(&stmt->value.w.stmts, refs);
+            break;
+        }
+    }
+}
+
+// Remove definitions of variables nothing refers to, so they get no frame slot. Returns whether any
+// was removed.
+static bool drop_unused(Block *block, const LiveSet *refs) {
+    bool dropped = false;
+    size_t len = 0;
+    for (size_t i = 0; i < block->len; i++) {
+        Statement *stmt = stmt_at(program, block, i);
+
+        if (stmt->kind == S_DEFINITION && !live_has(refs, stmt->value.d.decl.name) &&
+            is_pure(stmt->value.d.expr)) {
+            dropped = true;
+            continue;
+        } else if (stmt->kind == S_IF) {
+            dropped = drop_unused(&stmt->value.i.stmts, refs) || dropped;
+        } else if (stmt->kind == S_WHILE) {
+            dropped = drop_unused(&stmt->value.w.stmts, refs) || dropped;
+        }
+
+        program->stmts.items[block->start + len++] = *stmt;
+    }
+
+    block->len = len;
+
+    return dropped;
+}
+
+void eliminate_dead_stores(Program *prg, Function *func) {
+    program = prg;
+
+    clear(&local_index);
+    for (size_t i = 0; i < func->args.len; i++) {
+        Index local = {.key = func->args.items[i].name, .index = local_index.len};
+        insert(&local_index, local);
+    }
+    number_locals(&func->stmts);
+    live_words = (local_index.len + 63) / 64;
+    if (live_words == 0) {
+        return;
+    }
+
+    // Nothing is live once the function returns
+    LiveSet live = live_new(nullptr);
+    live_block(&func->stmts, &live, true);
+    live_free(&live);
+
+    // Removing a definition can leave what its initializer read unreferenced in turn, like the
+    // local an inlined argument was copied from, so unused definitions are dropped until none are
+    // left
+    for (bool dropped = true; dropped;) {
+        LiveSet refs = live_new(nullptr);
+        referenced_in(&func->stmts, &refs);
+        dropped = drop_unused(&func->stmts, &refs);
+        live_free(&refs);
+    }
+}
+
+/* Scopes */
+
+// The name a variable in scope was renamed to, and the block depth it was defined at
+typedef struct {
+    Atom key;
+    Atom name;
+    int depth;
+} Binding;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    uint32_t generation;
+    MapSlot *slots;
+    Binding *items;
+} Bindings;
+
+typedef struct {
+    Atom key;
+    bool shadows;
+    Binding binding;
+} ScopeEntry;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    ScopeEntry *items;
+} ScopeEntries;
+
+static Bindings bindings = {0};
+static ScopeEntries scope = {0};
+static IndexMap defined = {0}; // Times each name has been defined so far in the function
+static String spelling = {0};
+
+// "name.<tag><n>", which no identifier can spell
+static Atom fresh_name(Atom name, const char *tag, uint32_t n) {
+    StringView text = atom_view(name);
+    int len = snprintf(nullptr, 0, "%.*s.%s%u", (int)text.len, text.items, tag, n);
+    reserve(&spelling, (size_t)len + 1);
+    snprintf(spelling.items, len + 1, "%.*s.%s%u", (int)text.len, text.items, tag, n);
+
+    StringView view = {.items = spelling.items, .len = len};
+    return intern(&view);
+}
+
+static void bind_name(Atom *name, int depth) {
+    Binding *prev = get(&bindings, *name);
+    ScopeEntry entry = {.key = *name, .shadows = prev != nullptr};
+    if (prev != nullptr) {
+        entry.binding = *prev;
+    }
+
+    // A redefinition in the same block is left alone for the code generator to reject
+    Binding binding = {.key = *name, .name = *name, .depth = depth};
+    Index *count = get(&defined, *name);
+    if (count == nullptr) {
+        Index first = {.key = *name, .index = 1};
+        insert(&defined, first);
+    } else if (prev != nullptr && prev->depth == depth) {
+        binding.name = prev->name;
+    } else {
+        binding.name = fresh_name(*name, "", count->index++);
+    }
+
+    append(&scope, entry);
+    insert(&bindings, binding);
+    *name = binding.name;
+}
+
+static void resolve_name(Atom *name) {
+    Binding *binding = get(&bindings, *name);
+    if (binding != nullptr) {
+        *name = binding->name;
+    }
+}
+
+static void resolve_expr(ExprId id) {
+    Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+        break;
+    case E_IDENT:
+        resolve_name(&expr->value.id.name);
+        break;
+    case E_BINARY_OP:
+        resolve_expr(expr->value.b.left);
+        resolve_expr(expr->value.b.right);
+        break;
+    case E_CALL:
+        for (size_t i = 0; i < expr->value.c.args.len; i++) {
+            resolve_expr(list_at(program, &expr->value.c.args, i));
+        }
+        break;
+    }
+}
+
+static void resolve_block(const Block *block, int depth) {
+    size_t mark = scope.len;
+
+    for (size_t i = 0; i < block->len; i++) {
+        Statement *stmt = stmt_at(program, block, i);
+
+        switch (stmt->kind) {
+        case S_DEFINITION:
+            // The new variable is already in scope in its own initializer, as in the code generator
+            bind_name(&stmt->value.d.decl.name, depth);
+            resolve_expr(stmt->value.d.expr);
+            break;
+        case S_ASSIGN:
+            resolve_name(&stmt->value.a.name);
+            resolve_expr(stmt->value.a.expr);
+            break;
+        case S_EXPR:
+            resolve_expr(stmt->value.e.expr);
+            break;
+        case S_RETURN:
+            if (stmt->value.r.expr != NO_EXPR) {
+                resolve_expr(stmt->value.r.expr);
+            }
+            break;
+        case S_IF:
+            resolve_expr(stmt->value.i.expr);
+            resolve_block(&stmt->value.i.stmts, depth + 1);
+            break;
+        case S_WHILE:
+            resolve_expr(stmt->value.w.expr);
+            resolve_block(&stmt->value.w.stmts, depth + 1);
+            break;
+        }
+    }
+
+    while (scope.len > mark) {
+        ScopeEntry *entry = &scope.items[--scope.len];
+        if (entry->shadows) {
+            insert(&bindings, entry->binding);
+        } else {
+            erase(&bindings, entry->key);
+        }
+    }
+}
+
+// Give every variable that shadows or reuses an earlier name a name of its own, so the passes below
+// can treat a function's variables as one flat set. The new names can't clash with identifiers.
+void resolve_scopes(Program *prg, Function *func) {
+    program = prg;
+
+    clear(&bindings);
+    clear(&defined);
+    scope.len = 0;
+    for (size_t i = 0; i < func->args.len; i++) {
+        bind_name(&func->args.items[i].name, 0);
+    }
+
+    // The function body is the same scope as the arguments
+    resolve_block(&func->stmts, 0);
+}
+
+/* Evaluation */
+
+// Bounds on evaluating one call at compile time: statements and expression nodes visited, and
+// nested calls. A call that runs out is left for run time.
+#define EVAL_FUEL 100000
+#define EVAL_DEPTH 64
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    bool *items;
+} Flags;
+
+// A variable of a function being evaluated. Frames and blocks push their variables and pop them on
+// the way out, so a name resolves to the innermost definition as it does in the code generator.
+typedef struct {
+    Atom name;
+    int bits;
+    bool ready; // False while its initializer runs
+    long value;
+} EvalVar;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    EvalVar *items;
+} EvalVars;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    long *items;
+} Longs;
+
+typedef enum { EVAL_NEXT, EVAL_RETURN, EVAL_FAIL } EvalStatus;
+
+static Flags evaluable = {0}; // By function index: only computes on integers and calls the same
+static EvalVars eval_vars = {0};
+static Longs eval_args = {0}; // Arguments of the calls being evaluated, innermost last
+static size_t eval_frame = 0; // Where the current call's variables start in eval_vars
+static long eval_fuel = 0;
+static int eval_depth = 0;
+static size_t evaluated = 0; // Calls replaced by their result so far
+
+static bool expr_evaluable(ExprId id, size_t caller) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+        return expr->value.v.kind == V_NUMBER;
+    case E_IDENT:
+        return true;
+    case E_BINARY_OP:
+        return expr_evaluable(expr->value.b.left, caller) &&
+               expr_evaluable(expr->value.b.right, caller);
+    case E_CALL: {
+        const CallExpr *call = &expr->value.c;
+        Index *fn = get(&functions, call->name);
+        if (fn == nullptr || fn->index > caller || !evaluable.items[fn->index] ||
+            program->funcs.items[fn->index].args.len != call->args.len) {
+            return false;
+        }
+        for (size_t i = 0; i < call->args.len; i++) {
+            if (!expr_evaluable(list_at(program, &call->args, i), caller)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    }
+
+    return false;
+}
+
+static bool block_evaluable(const Block *block, size_t caller) {
+    for (size_t i = 0; i < block->len; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+
+        switch (stmt->kind) {
+        case S_DEFINITION:
+            if (stmt->value.d.decl.type.pointer || !expr_evaluable(stmt->value.d.expr, caller)) {
+                return false;
+            }
+            break;
+        case S_ASSIGN:
+            if (!expr_evaluable(stmt->value.a.expr, caller)) {
+                return false;
+            }
+            break;
+        case S_EXPR:
+            if (!expr_evaluable(stmt->value.e.expr, caller)) {
+                return false;
+            }
+            break;
+        case S_RETURN:
+            if (stmt->value.r.expr != NO_EXPR && !expr_evaluable(stmt->value.r.expr, caller)) {
+                return false;
+            }
+            break;
+        case S_IF:
+            if (!expr_evaluable(stmt->value.i.expr, caller) ||
+                !block_evaluable(&stmt->value.i.stmts, caller)) {
+                return false;
+            }
+            break;
+        case S_WHILE:
+            if (!expr_evaluable(stmt->value.w.expr, caller) ||
+                !block_evaluable(&stmt->value.w.stmts, caller)) {
+                return false;
+            }
+            break;
+        }
+    }
+
+    return true;
+}
+
+// A function can be evaluated if it only works on integer variables and calls functions that can
+// be, itself or ones defined before it. Every function starts out assumed evaluable and those that
+// aren't are struck off until nothing changes, so recursive functions stay in.
+static void find_evaluable(void) {
+    evaluable.len = 0;
+    for (size_t i = 0; i < program->funcs.len; i++) {
+        const Function *func = &program->funcs.items[i];
+        bool ok = !func->decl.type.pointer && func->decl.type.name != A_VOID;
+        for (size_t j = 0; j < func->args.len; j++) {
+            ok = ok && !func->args.items[j].type.pointer;
+        }
+        append(&evaluable, ok);
+    }
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 0; i < program->funcs.len; i++) {
+            if (evaluable.items[i] && !block_evaluable(&program->funcs.items[i].stmts, i)) {
+                evaluable.items[i] = false;
+                changed = true;
+            }
+        }
+    }
+}
+
+// Pointers are invalidated by evaluating a call, which pushes its frame's variables
+static EvalVar *eval_lookup(Atom name) {
+    for (size_t i = eval_vars.len; i-- > eval_frame;) {
+        if (eval_vars.items[i].name == name) {
+            return &eval_vars.items[i];
+        }
+    }
+
+    return nullptr;
+}
+
+// The width an expression computes in, as expr_bits infers it but from the evaluated variables
+static int eval_bits(ExprId id) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+        return 0;
+    case E_IDENT: {
+        EvalVar *var = eval_lookup(expr->value.id.name);
+        return var != nullptr ? var->bits : 0;
+    }
+    case E_CALL: {
+        Index *fn = get(&functions, expr->value.c.name);
+        return fn != nullptr ? type_bits(&program->funcs.items[fn->index].decl.type) : 0;
+    }
+    case E_BINARY_OP: {
+        int bits = eval_bits(expr->value.b.left);
+        return bits != 0 ? bits : eval_bits(expr->value.b.right);
+    }
+    }
+
+    return 0;
+}
+
+static int eval_context_bits(ExprId id) {
+    int bits = eval_bits(id);
+
+    return bits != 0 ? bits : 32;
+}
+
+static bool eval_call(const Function *func, const long *args, long *result);
+
+// Computes with the same widths as folding, so evaluating a call agrees with folding its inlined
+// body
+static bool eval_expr(ExprId id, int bits, long *value) {
+    if (--eval_fuel < 0) {
+        return false;
+    }
+
+    const Expr *expr = expr_at(program, id);
+    switch (expr->kind) {
+    case E_VALUE:
+        if (expr->value.v.kind != V_NUMBER) {
+            return false;
+        }
+        *value = expr->value.v.value.num;
+        return true;
+    case E_IDENT: {
+        EvalVar *var = eval_lookup(expr->value.id.name);
+        if (var == nullptr || !var->ready) {
+            return false;
+        }
+        *value = var->value;
+        return true;
+    }
+    case E_BINARY_OP: {
+        BinaryOpExpr bop = expr->value.b;
+        long l, r;
+
+        if (bop.op == OP_LAND || bop.op == OP_LOR) {
+            bool decides = bop.op == OP_LOR;
+            if (!eval_expr(bop.left, eval_context_bits(bop.left), &l)) {
+                return false;
+            }
+            if ((l != 0) == decides) {
+                *value = decides;
+                return true;
+            }
+            if (!eval_expr(bop.right, eval_context_bits(bop.right), &r)) {
+                return false;
+            }
+            *value = r != 0;
+            return true;
+        }
+
+        int opbits = is_boolean_op(bop.op) ? eval_context_bits(id) : bits;
+        return eval_expr(bop.left, opbits, &l) && eval_expr(bop.right, opbits, &r) &&
+               fold_arith(bop.op, l, r, opbits, value);
+    }
+    case E_CALL: {
+        CallExpr call = expr->value.c;
+        Index *fn = get(&functions, call.name);
+        if (fn == nullptr || !evaluable.items[fn->index] ||
+            program->funcs.items[fn->index].args.len != call.args.len) {
+            return false;
+        }
+
+        size_t mark = eval_args.len;
+        bool ok = true;
+        for (size_t i = 0; i < call.args.len && ok; i++) {
+            ExprId arg = list_at(program, &call.args, i);
+            long result = 0;
+            ok = eval_expr(arg, eval_context_bits(arg), &result);
+            append(&eval_args, result);
+        }
+
+        ok = ok && eval_call(&program->funcs.items[fn->index], &eval_args.items[mark], value);
+        eval_args.len = mark;
+        return ok;
+    }
+    }
+
+    return false;
+}
+
+static EvalStatus eval_block(const Block *block, const Type *fntype, long *result) {
+    size_t mark = eval_vars.len;
+    EvalStatus status = EVAL_NEXT;
+
+    for (size_t i = 0; i < block->len && status == EVAL_NEXT; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+        long value;
+
+        if (--eval_fuel < 0) {
+            status = EVAL_FAIL;
+            break;
+        }
+
+        switch (stmt->kind) {
+        case S_DEFINITION: {
+            const DefinitionStatement *def = &stmt->value.d;
+            int bits = type_bits(&def->decl.type);
+
+            // In scope in its own initializer, with no value to read
+            EvalVar var = {.name = def->decl.name, .bits = bits};
+            append(&eval_vars, var);
+            size_t at = eval_vars.len - 1;
+            if (!eval_expr(def->expr, bits, &value)) {
+                status = EVAL_FAIL;
+                break;
+            }
+            eval_vars.items[at].ready = true;
+            eval_vars.items[at].value = wrap(value, bits);
+            break;
+        }
+        case S_ASSIGN: {
+            EvalVar *var = eval_lookup(stmt->value.a.name);
+            if (var == nullptr) {
+                status = EVAL_FAIL;
+                break;
+            }
+
+            size_t at = var - eval_vars.items;
+            if (!eval_expr(stmt->value.a.expr, var->bits, &value)) {
+                status = EVAL_FAIL;
+                break;
+            }
+            eval_vars.items[at].ready = true;
+            eval_vars.items[at].value = wrap(value, eval_vars.items[at].bits);
+            break;
+        }
+        case S_EXPR:
+            if (!eval_expr(stmt->value.e.expr, eval_context_bits(stmt->value.e.expr), &value)) {
+                status = EVAL_FAIL;
+            }
+            break;
+        case S_RETURN:
+            if (stmt->value.r.expr == NO_EXPR ||
+                !eval_expr(stmt->value.r.expr, type_bits(fntype), &value)) {
+                status = EVAL_FAIL;
+                break;
+            }
+            *result = wrap(value, type_bits(fntype));
+            status = EVAL_RETURN;
+            break;
+        case S_IF:
+            if (!eval_expr(stmt->value.i.expr, eval_context_bits(stmt->value.i.expr), &value)) {
+                status = EVAL_FAIL;
+            } else if (value != 0) {
+                status = eval_block(&stmt->value.i.stmts, fntype, result);
+            }
+            break;
+        case S_WHILE:
+            while (status == EVAL_NEXT) {
+                if (!eval_expr(stmt->value.w.expr, eval_context_bits(stmt->value.w.expr), &value)) {
+                    status = EVAL_FAIL;
+                } else if (value == 0) {
+                    break;
+                } else {
+                    status = eval_block(&stmt->value.w.stmts, fntype, result);
+                }
+            }
+            break;
+        }
+    }
+
+    eval_vars.len = mark;
+
+    return status;
+}
+
+static bool eval_call(const Function *func, const long *args, long *result) {
+    if (eval_depth == EVAL_DEPTH) {
+        return false;
+    }
+
+    size_t frame = eval_frame;
+    eval_frame = eval_vars.len;
+    eval_depth++;
+
+    for (size_t i = 0; i < func->args.len; i++) {
+        int bits = type_bits(&func->args.items[i].type);
+        EvalVar var = {
+            .name = func->args.items[i].name,
+            .bits = bits,
+            .ready = true,
+            .value = wrap(args[i], bits),
+        };
+        append(&eval_vars, var);
+    }
+
+    // Running off the end of the function leaves no value to use
+    EvalStatus status = eval_block(&func->stmts, &func->decl.type, result);
+
+    eval_depth--;
+    eval_vars.len = eval_frame;
+    eval_frame = frame;
+
+    return status == EVAL_RETURN;
+}
+
+// Replace calls to evaluable int functions with constant int arguments by their result. A literal
+// is typed as int, so other types are left alone.
+static void evaluate_expr(ExprId id, size_t caller) {
+    Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+    case E_IDENT:
+        break;
+    case E_BINARY_OP: {
+        BinaryOpExpr bop = expr->value.b;
+        evaluate_expr(bop.left, caller);
+        evaluate_expr(bop.right, caller);
+        break;
+    }
+    case E_CALL: {
+        CallExpr call = expr->value.c;
+        for (size_t i = 0; i < call.args.len; i++) {
+            evaluate_expr(list_at(program, &call.args, i), caller);
+        }
+
+        Index *fn = get(&functions, call.name);
+        if (fn == nullptr || fn->index > caller || !evaluable.items[fn->index]) {
+            break;
+        }
+
+        const Function *callee = &program->funcs.items[fn->index];
+        if (callee->args.len != call.args.len || !is_int(&callee->decl.type)) {
+            break;
+        }
+
+        eval_args.len = 0;
+        for (size_t i = 0; i < call.args.len; i++) {
+            long value;
+            if (!is_int(&callee->args.items[i].type) ||
+                !is_number(list_at(program, &call.args, i), &value)) {
+                return;
+            }
+            append(&eval_args, value);
+        }
+
+        long result;
+        eval_fuel = EVAL_FUEL;
+        if (eval_call(callee, eval_args.items, &result)) {
+            set_number(id, result);
+            evaluated++;
+        }
+        break;
+    }
+    }
+}
+
+static void evaluate_block(const Block *block, size_t caller) {
+    for (size_t i = 0; i < block->len; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+
+        switch (stmt->kind) {
+        case S_DEFINITION:
+            evaluate_expr(stmt->value.d.expr, caller);
+            break;
+        case S_ASSIGN:
+            evaluate_expr(stmt->value.a.expr, caller);
+            break;
+        case S_EXPR:
+            evaluate_expr(stmt->value.e.expr, caller);
+            break;
+        case S_RETURN:
+            if (stmt->value.r.expr != NO_EXPR) {
+                evaluate_expr(stmt->value.r.expr, caller);
+            }
+            break;
+        case S_IF:
+            evaluate_expr(stmt->value.i.expr, caller);
+            evaluate_block(&stmt->value.i.stmts, caller);
+            break;
+        case S_WHILE:
+            evaluate_expr(stmt->value.w.expr, caller);
+            evaluate_block(&stmt->value.w.stmts, caller);
+            break;
+        }
+    }
+}
+
+// Returns whether any call was evaluated
+bool evaluate_function(Program *prg, Function *func) {
+    program = prg;
+
+    size_t before = evaluated;
+    evaluate_block(&func->stmts, func - prg->funcs.items);
+
+    return evaluated != before;
+}
+
+/* Inlining */
+
+InlineConfig inlining = {.threshold = 16};
+
+// What a name in the inlined body becomes at the call site: another name, or for an argument
+// substituted straight into an expression, that argument
+typedef struct {
+    Atom key;
+    Atom name;
+    ExprId expr;
+} Rename;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    uint32_t generation;
+    MapSlot *slots;
+    Rename *items;
+} Renames;
+
+static Renames renames = {0};
+static Statements inline_stack = {0}; // Statements of blocks being rebuilt, as in the parser
+static ExprIds clone_args = {0};
+static uint32_t inline_site = 0; // Numbers the names introduced at each site
+static bool clone_returns = false;
+
+static ExprId push_expr(Expr expr) {
+    append(&program->exprs, expr);
+
+    return program->exprs.len - 1;
+}
+
+static size_t expr_cost(ExprId id) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+    case E_IDENT:
+        return 1;
+    case E_BINARY_OP:
+        return 1 + expr_cost(expr->value.b.left) + expr_cost(expr->value.b.right);
+    case E_CALL: {
+        size_t cost = 1;
+        for (size_t i = 0; i < expr->value.c.args.len; i++) {
+            cost += expr_cost(list_at(program, &expr->value.c.args, i));
+        }
+        return cost;
+    }
+    }
+
+    return 1;
+}
+
+static bool expr_calls(ExprId id, Atom fn) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+    case E_IDENT:
+        return false;
+    case E_BINARY_OP:
+        return expr_calls(expr->value.b.left, fn) || expr_calls(expr->value.b.right, fn);
+    case E_CALL:
+        if (expr->value.c.name == fn) {
+            return true;
+        }
+        for (size_t i = 0; i < expr->value.c.args.len; i++) {
+            if (expr_calls(list_at(program, &expr->value.c.args, i), fn)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    return false;
+}
+
+// The cost of a body is its statements plus their expression nodes. Returns SIZE_MAX for a body
+// that calls fn, or that returns anywhere but its last top level statement, which inlining can't
+// express without a jump.
+static size_t block_cost(const Block *block, Atom fn, bool top) {
+    size_t cost = 0;
+    for (size_t i = 0; i < block->len; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+        ExprId expr = NO_EXPR;
+        const Block *body = nullptr;
+
+        switch (stmt->kind) {
+        case S_DEFINITION:
+            expr = stmt->value.d.expr;
+            break;
+        case S_ASSIGN:
+            expr = stmt->value.a.expr;
+            break;
+        case S_EXPR:
+            expr = stmt->value.e.expr;
+            break;
+        case S_RETURN:
+            if (!top || i != block->len - 1) {
+                return SIZE_MAX;
+            }
+            expr = stmt->value.r.expr;
+            break;
+        case S_IF:
+            expr = stmt->value.i.expr;
+            body = &stmt->value.i.stmts;
+            break;
+        case S_WHILE:
+            expr = stmt->value.w.expr;
+            body = &stmt->value.w.stmts;
+            break;
+        }
+
+        cost++;
+        if (expr != NO_EXPR) {
+            if (expr_calls(expr, fn)) {
+                return SIZE_MAX;
+            }
+            cost += expr_cost(expr);
+        }
+        if (body != nullptr) {
+            size_t inner = block_cost(body, fn, false);
+            if (inner == SIZE_MAX) {
+                return SIZE_MAX;
+            }
+            cost += inner;
+        }
+    }
+
+    return cost;
+}
+
+// Only functions defined before the caller can be called from it, as in the code generator
+static const Function *inline_candidate(const Function *caller, const CallExpr *call) {
+    Index *fn = get(&functions, call->name);
+    if (fn == nullptr || fn->index >= (size_t)(caller - program->funcs.items)) {
+        return nullptr;
+    }
+
+    const Function *callee = &program->funcs.items[fn->index];
+    if (callee->args.len != call->args.len ||
+        block_cost(&callee->stmts, callee->decl.name, true) > inlining.threshold) {
+        return nullptr;
+    }
+
+    return callee;
+}
+
+// The expression of the return ending a body, if there is one
+static ExprId returned_expr(const Function *callee) {
+    const Block *body = &callee->stmts;
+    if (body->len == 0) {
+        return NO_EXPR;
+    }
+
+    const Statement *last = stmt_at(program, body, body->len - 1);
+    return last->kind == S_RETURN ? last->value.r.expr : NO_EXPR;
+}
+
+// Arguments are cloned without renaming, they belong to the caller
+static ExprId clone_expr(ExprId id, bool rename) {
+    Expr expr = *expr_at(program, id);
+
+    switch (expr.kind) {
+    case E_VALUE:
+        break;
+    case E_IDENT: {
+        Rename *r = rename ? get(&renames, expr.value.id.name) : nullptr;
+        if (r != nullptr && r->expr != NO_EXPR) {
+            return clone_expr(r->expr, false);
+        }
+        if (r != nullptr) {
+            expr.value.id.name = r->name;
+        }
+        break;
+    }
+    case E_BINARY_OP:
+        expr.value.b.left = clone_expr(expr.value.b.left, rename);
+        expr.value.b.right = clone_expr(expr.value.b.right, rename);
+        break;
+    case E_CALL: {
+        size_t mark = clone_args.len;
+        for (size_t i = 0; i < expr.value.c.args.len; i++) {
+            ExprId arg = clone_expr(list_at(program, &expr.value.c.args, i), rename);
+            append(&clone_args, arg);
+        }
+
+        expr.value.c.args.start = program->lists.len;
+        append_n(&program->lists, &clone_args.items[mark], expr.value.c.args.len);
+        clone_args.len = mark;
+        break;
+    }
+    }
+
+    return push_expr(expr);
+}
+
+static Block clone_block(const Block *block);
+
+// Appends renamed copies of a body's statements to inline_stack. Returns are only copied when a
+// whole function is cloned, inlining leaves out the final one.
+static void clone_statements(const Block *block) {
+    for (size_t i = 0; i < block->len; i++) {
+        Statement stmt = *stmt_at(program, block, i);
+
+        switch (stmt.kind) {
+        case S_DEFINITION: {
+            DefinitionStatement *def = &stmt.value.d;
+            Rename r = {
+                .key = def->decl.name,
+                .name = fresh_name(def->decl.name, "inline", inline_site),
+                .expr = NO_EXPR,
+            };
+            insert(&renames, r);
+            def->decl.name = r.name;
+            def->expr = clone_expr(def->expr, true);
+            break;
+        }
+        case S_ASSIGN: {
+            Rename *r = get(&renames, stmt.value.a.name);
+            if (r != nullptr) {
+                stmt.value.a.name = r->name;
+            }
+            stmt.value.a.expr = clone_expr(stmt.value.a.expr, true);
+            break;
+        }
+        case S_EXPR:
+            stmt.value.e.expr = clone_expr(stmt.value.e.expr, true);
+            break;
+        case S_IF:
+            stmt.value.i.expr = clone_expr(stmt.value.i.expr, true);
+            stmt.value.i.stmts = clone_block(&stmt.value.i.stmts);
+            break;
+        case S_WHILE:
+            stmt.value.w.expr = clone_expr(stmt.value.w.expr, true);
+            stmt.value.w.stmts = clone_block(&stmt.value.w.stmts);
+            break;
+        case S_RETURN:
+            if (!clone_returns) {
+                continue;
+            }
+            if (stmt.value.r.expr != NO_EXPR) {
+                stmt.value.r.expr = clone_expr(stmt.value.r.expr, true);
+            }
+            break;
+        }
+
+        append(&inline_stack, stmt);
+    }
+}
+
+static Block clone_block(const Block *block) {
+    size_t mark = inline_stack.len;
+    clone_statements(block);
+
+    Block copy = {.start = program->stmts.len, .len = inline_stack.len - mark};
+    append_n(&program->stmts, &inline_stack.items[mark], copy.len);
+    inline_stack.len = mark;
+
+    return copy;
+}
+
+// Whether every variable and call result in the expression has the given type. Call arguments
+// are left out, each is checked against its parameter on its own.
+static bool typed_as(ExprId id, const Type *type) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+        return expr->value.v.kind == V_NUMBER;
+    case E_IDENT: {
+        Local *local = get(&locals, expr->value.id.name);
+        return local != nullptr && same_type(&local->type, type);
+    }
+    case E_BINARY_OP:
+        return typed_as(expr->value.b.left, type) && typed_as(expr->value.b.right, type);
+    case E_CALL: {
+        Index *fn = get(&functions, expr->value.c.name);
+        return fn != nullptr && same_type(&program->funcs.items[fn->index].decl.type, type);
+    }
+    }
+
+    return false;
+}
+
+static bool leads_with_number(ExprId id) {
+    const Expr *expr = expr_at(program, id);
+    while (expr->kind == E_BINARY_OP) {
+        expr = expr_at(program, expr->value.b.left);
+    }
+
+    return expr->kind == E_VALUE && expr->value.v.kind == V_NUMBER;
+}
+
+// An argument is typed by its first operand, so the call is known to type check only when that
+// and every other operand has the parameter's type
+static bool matches_param(ExprId arg, const Type *param) {
+    return typed_as(arg, param) && (is_int(param) || !leads_with_number(arg));
+}
+
+// A pure int function whose body is a single return of a pure expression, called with pure
+// arguments, is replaced by that expression with the arguments substituted for its parameters.
+// Literals are typed int wherever they appear, so only int functions in an expression that is int
+// throughout can be substituted without changing how the code generator types it.
+static bool substitute_call(const Function *caller, ExprId id, ExprId root, const Type *context) {
+    const CallExpr *call = &expr_at(program, id)->value.c;
+    const Function *callee = inline_candidate(caller, call);
+    if (callee == nullptr || callee->stmts.len != 1 || !is_int(&callee->decl.type) ||
+        (context != nullptr && !same_type(context, &callee->decl.type)) ||
+        !typed_as(root, &callee->decl.type)) {
+        return false;
+    }
+
+    ExprId body = returned_expr(callee);
+    if (body == NO_EXPR || !is_pure(body)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < call->args.len; i++) {
+        ExprId arg = list_at(program, &call->args, i);
+        if (!is_int(&callee->args.items[i].type) || !is_pure(arg) ||
+            !matches_param(arg, &callee->args.items[i].type)) {
+            return false;
+        }
+    }
+
+    clear(&renames);
+    for (size_t i = 0; i < call->args.len; i++) {
+        Rename r = {.key = callee->args.items[i].name, .expr = list_at(program, &call->args, i)};
+        insert(&renames, r);
+    }
+
+    ExprId copy = clone_expr(body, true);
+    *expr_at(program, id) = *expr_at(program, copy);
+    inlining.sites++;
+
+    return true;
+}
+
+static void inline_expr(const Function *caller, ExprId id, ExprId root, const Type *context) {
+    Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+    case E_IDENT:
+        break;
+    case E_BINARY_OP: {
+        BinaryOpExpr bop = expr->value.b;
+        inline_expr(caller, bop.left, root, context);
+        inline_expr(caller, bop.right, root, context);
+        break;
+    }
+    case E_CALL: {
+        CallExpr call = expr->value.c;
+        Index *fn = get(&functions, call.name);
+        for (size_t i = 0; i < call.args.len; i++) {
+            const Function *callee = fn != nullptr ? &program->funcs.items[fn->index] : nullptr;
+            const Type *param = callee != nullptr && i < callee->args.len
+                                    ? &callee->args.items[i].type
+                                    : nullptr;
+            ExprId arg = list_at(program, &call.args, i);
+            inline_expr(caller, arg, arg, param);
+        }
+
+        substitute_call(caller, id, root, context);
+        break;
+    }
+    }
+}
+
+// A call that makes up the whole expression of a statement is expanded in place: each argument is
+// stored in a new local for its parameter, then come the body's statements with their variables
+// renamed, and the final return becomes the statement with the returned expression in place of
+// the call. Returns whether the statement was replaced.
+static bool expand_call(const Function *caller, const Statement *stmt) {
+    ExprId site = NO_EXPR;
+    const Type *want = nullptr;
+    switch (stmt->kind) {
+    case S_DEFINITION:
+        site = stmt->value.d.expr;
+        want = &stmt->value.d.decl.type;
+        break;
+    case S_ASSIGN: {
+        site = stmt->value.a.expr;
+        Local *local = get(&locals, stmt->value.a.name);
+        if (local == nullptr) {
+            return false;
+        }
+        want = &local->type;
+        break;
+    }
+    case S_EXPR:
+        site = stmt->value.e.expr;
+        break;
+    case S_RETURN:
+        site = stmt->value.r.expr;
+        want = &caller->decl.type;
+        break;
+    case S_IF:
+    case S_WHILE:
+        return false;
+    }
+
+    if (site == NO_EXPR || expr_at(program, site)->kind != E_CALL) {
+        return false;
+    }
+
+    CallExpr call = expr_at(program, site)->value.c;
+    const Function *callee = inline_candidate(caller, &call);
+    if (callee == nullptr) {
+        return false;
+    }
+
+    // Without a result to take its place, the returned expression is kept for its calls, and is
+    // then typed by its own operands, so only an int one is sure to type the same
+    const Type *ret = &callee->decl.type;
+    ExprId result = returned_expr(callee);
+    bool is_void = ret->name == A_VOID && !ret->pointer;
+    if (is_void ? result != NO_EXPR || want != nullptr
+                : result == NO_EXPR || (want != nullptr && !same_type(want, ret)) ||
+                      (want == nullptr && !is_int(ret) && !is_pure(result))) {
+        return false;
+    }
+
+    for (size_t i = 0; i < call.args.len; i++) {
+        if (!matches_param(list_at(program, &call.args, i), &callee->args.items[i].type)) {
+            return false;
+        }
+    }
+
+    clear(&renames);
+    inline_site++;
+    for (size_t i = 0; i < call.args.len; i++) {
+        const Declaration *param = &callee->args.items[i];
+        Rename r = {
+            .key = param->name,
+            .name = fresh_name(param->name, "inline", inline_site),
+            .expr = NO_EXPR,
+        };
+        insert(&renames, r);
+
+        Statement def = {.kind = S_DEFINITION};
+        def.value.d.decl = (Declaration){.type = param->type, .name = r.name};
+        def.value.d.expr = list_at(program, &call.args, i);
+        append(&inline_stack, def);
+    }
+
+    clone_statements(&callee->stmts);
+
+    if (result != NO_EXPR) {
+        Statement last = *stmt;
+        ExprId value = clone_expr(result, true);
+        switch (last.kind) {
+        case S_DEFINITION:
+            last.value.d.expr = value;
+            break;
+        case S_ASSIGN:
+            last.value.a.expr = value;
+            break;
+        case S_EXPR:
+            last.value.e.expr = value;
+            break;
+        case S_RETURN:
+            last.value.r.expr = value;
+            break;
+        case S_IF:
+        case S_WHILE:
+            break;
+        }
+        append(&inline_stack, last);
+    }
+    inlining.sites++;
+
+    return true;
+}
+
+static void inline_block(const Function *caller, Block *block) {
+    size_t mark = inline_stack.len;
+    bool expanded = false;
+
+    for (size_t i = 0; i < block->len; i++) {
+        Statement stmt = *stmt_at(program, block, i);
+
+        switch (stmt.kind) {
+        case S_DEFINITION:
+            inline_expr(caller, stmt.value.d.expr, stmt.value.d.expr, &stmt.value.d.decl.type);
+            break;
+        case S_ASSIGN: {
+            Local *local = get(&locals, stmt.value.a.name);
+            inline_expr(caller, stmt.value.a.expr, stmt.value.a.expr,
+                        local != nullptr ? &local->type : nullptr);
+            break;
+        }
+        case S_EXPR:
+            inline_expr(caller, stmt.value.e.expr, stmt.value.e.expr, nullptr);
+            break;
+        case S_RETURN:
+            if (stmt.value.r.expr != NO_EXPR) {
+                inline_expr(caller, stmt.value.r.expr, stmt.value.r.expr, &caller->decl.type);
+            }
+            break;
+        case S_IF:
+            inline_expr(caller, stmt.value.i.expr, stmt.value.i.expr, nullptr);
+            inline_block(caller, &stmt.value.i.stmts);
+            break;
+        case S_WHILE:
+            inline_expr(caller, stmt.value.w.expr, stmt.value.w.expr, nullptr);
+            inline_block(caller, &stmt.value.w.stmts);
+            break;
+        }
+
+        if (expand_call(caller, &stmt)) {
+            expanded = true;
+        } else {
+            append(&inline_stack, stmt);
+        }
+    }
+
+    // The rebuilt block only fits back in place if no call was expanded
+    size_t len = inline_stack.len - mark;
+    if (expanded) {
+        block->start = program->stmts.len;
+        append_n(&program->stmts, &inline_stack.items[mark], len);
+    } else {
+        memcpy(&program->stmts.items[block->start], &inline_stack.items[mark],
+               len * sizeof(Statement));
+    }
+    block->len = len;
+    inline_stack.len = mark;
+}
+
+static void collect_locals(const Block *block) {
+    for (size_t i = 0; i < block->len; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+
+        switch (stmt->kind) {
+        case S_DEFINITION: {
+            Local local = {.key = stmt->value.d.decl.name, .type = stmt->value.d.decl.type};
+            insert(&locals, local);
+            break;
+        }
+        case S_IF:
+            collect_locals(&stmt->value.i.stmts);
+            break;
+        case S_WHILE:
+            collect_locals(&stmt->value.w.stmts);
+            break;
+        case S_ASSIGN:
+        case S_EXPR:
+        case S_RETURN:
+            break;
+        }
+    }
+}
+
+// Returns whether any call was inlined
+bool inline_function(Program *prg, Function *func) {
+    program = prg;
+
+    // Names are unique within a function once scopes are resolved, so one flat map types them all
+    clear(&locals);
+    for (size_t i = 0; i < func->args.len; i++) {
+        Local local = {.key = func->args.items[i].name, .type = func->args.items[i].type};
+        insert(&locals, local);
+    }
+    collect_locals(&func->stmts);
+
+    size_t sites = inlining.sites;
+    inline_block(func, &func->stmts);
+
+    return inlining.sites != sites;
+}
+
+// Folding first gives propagation more constants to work with. Propagation folds what it
+// substitutes into as it goes, and leaves constant arguments for calls that can be evaluated. A
+// final fold drops the branches that became dead and splices in those always taken. Stores are
+// removed last, once propagation has replaced as many reads as it can.
+static void optimize_function(Program *prg, Function *func) {
+    resolve_scopes(prg, func);
+    fold_function(prg, func);
+    propagate_function(prg, func);
+    // An evaluated call leaves a constant that can be propagated into further calls
+    while (evaluate_function(prg, func)) {
+        fold_function(prg, func);
+        propagate_function(prg, func);
+    }
+    fold_function(prg, func);
+    eliminate_dead_stores(prg, func);
+}
+
+/* Specialization */
+
+// A constant has to be passed by at least this many calls for a clone to pay for itself
+#define CLONE_MIN_CALLS 2
+
+CloneConfig cloning = {.budget = 8};
+
+// A constant passed for one parameter of a function, and how many calls pass it
+typedef struct {
+    uint32_t fn;
+    uint32_t param;
+    long value;
+    size_t calls;
+} Candidate;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    Candidate *items;
+} Candidates;
+
+static Candidates candidates = {0};
+
+// The function of a call that can be specialized: known, not main, and called with all its
+// arguments. A function can only call those defined before it, so a call from earlier on, or from
+// the function itself, couldn't call a clone placed after it.
+static const Function *clone_target(const CallExpr *call, size_t caller, uint32_t *index) {
+    Index *fn = get(&functions, call->name);
+    if (fn == nullptr || fn->index >= caller) {
+        return nullptr;
+    }
+
+    const Function *callee = &program->funcs.items[fn->index];
+    StringView name = atom_view(callee->decl.name);
+    if (stringcmp_cstr(&name, "main") == 0 || callee->args.len != call->args.len) {
+        return nullptr;
+    }
+
+    *index = fn->index;
+    return callee;
+}
+
+static void count_expr(ExprId id, size_t caller) {
+    const Expr *expr = expr_at(program, id);
+
+    switch (expr->kind) {
+    case E_VALUE:
+    case E_IDENT:
+        break;
+    case E_BINARY_OP:
+        count_expr(expr->value.b.left, caller);
+        count_expr(expr->value.b.right, caller);
+        break;
+    case E_CALL: {
+        const CallExpr *call = &expr->value.c;
+        for (size_t i = 0; i < call->args.len; i++) {
+            count_expr(list_at(program, &call->args, i), caller);
+        }
+
+        uint32_t fn;
+        const Function *callee = clone_target(call, caller, &fn);
+        if (callee == nullptr) {
+            break;
+        }
+
+        for (uint32_t param = 0; param < call->args.len; param++) {
+            long value;
+            if (!is_int(&callee->args.items[param].type) ||
+                !is_number(list_at(program, &call->args, param), &value)) {
+                continue;
+            }
+
+            size_t j = 0;
+            while (j < candidates.len &&
+                   (candidates.items[j].fn != fn || candidates.items[j].param != param ||
+                    candidates.items[j].value != value)) {
+                j++;
+            }
+            if (j == candidates.len) {
+                Candidate c = {.fn = fn, .param = param, .value = value};
+                append(&candidates, c);
+            }
+            candidates.items[j].calls++;
+        }
+        break;
+    }
+    }
+}
+
+static void count_block(const Block *block, size_t caller) {
+    for (size_t i = 0; i < block->len; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+
+        switch (stmt->kind) {
+        case S_DEFINITION:
+            count_expr(stmt->value.d.expr, caller);
+            break;
+        case S_ASSIGN:
+            count_expr(stmt->value.a.expr, caller);
+            break;
+        case S_EXPR:
+            count_expr(stmt->value.e.expr, caller);
+            break;
+        case S_RETURN:
+            if (stmt->value.r.expr != NO_EXPR) {
+                count_expr(stmt->value.r.expr, caller);
+            }
+            break;
+        case S_IF:
+            count_expr(stmt->value.i.expr, caller);
+            count_block(&stmt->value.i.stmts, caller);
+            break;
+        case S_WHILE:
+            count_expr(stmt->value.w.expr, caller);
+            count_block(&stmt->value.w.stmts, caller);
+            break;
+        }
+    }
+}
+
+// Point calls that pass the candidate's constant at the clone, without that argument. Returns
+// whether any call was changed.
+static bool redirect_expr(ExprId id, size_t caller, const Candidate *c, Atom clone) {
+    Expr *expr = expr_at(program, id);
+    bool changed = false;
+
+    switch (expr->kind) {
+    case E_VALUE:
+    case E_IDENT:
+        break;
+    case E_BINARY_OP: {
+        BinaryOpExpr bop = expr->value.b;
+        changed = redirect_expr(bop.left, caller, c, clone);
+        changed = redirect_expr(bop.right, caller, c, clone) || changed;
+        break;
+    }
+    case E_CALL: {
+        CallExpr call = expr->value.c;
+        for (size_t i = 0; i < call.args.len; i++) {
+            changed = redirect_expr(list_at(program, &call.args, i), caller, c, clone) || changed;
+        }
+
+        uint32_t fn;
+        long value;
+        if (clone_target(&call, caller, &fn) == nullptr || fn != c->fn ||
+            !is_number(list_at(program, &call.args, c->param), &value) || value != c->value) {
+            break;
+        }
+
+        size_t start = program->lists.len;
+        for (size_t i = 0; i < call.args.len; i++) {
+            if (i != c->param) {
+                append(&program->lists, list_at(program, &call.args, i));
+            }
+        }
+
+        expr = expr_at(program, id);
+        expr->value.c.name = clone;
+        expr->value.c.args = (ExprList){.start = start, .len = call.args.len - 1};
+        changed = true;
+        break;
+    }
+    }
+
+    return changed;
+}
+
+static bool redirect_block(const Block *block, size_t caller, const Candidate *c, Atom clone) {
+    bool changed = false;
+    for (size_t i = 0; i < block->len; i++) {
+        const Statement *stmt = stmt_at(program, block, i);
+
+        switch (stmt->kind) {
+        case S_DEFINITION:
+            changed = redirect_expr(stmt->value.d.expr, caller, c, clone) || changed;
+            break;
+        case S_ASSIGN:
+            changed = redirect_expr(stmt->value.a.expr, caller, c, clone) || changed;
+            break;
+        case S_EXPR:
+            changed = redirect_expr(stmt->value.e.expr, caller, c, clone) || changed;
+            break;
+        case S_RETURN:
+            if (stmt->value.r.expr != NO_EXPR) {
+                changed = redirect_expr(stmt->value.r.expr, caller, c, clone) || changed;
+            }
+            break;
+        case S_IF:
+            changed = redirect_expr(stmt->value.i.expr, caller, c, clone) || changed;
+            changed = redirect_block(&stmt->value.i.stmts, caller, c, clone) || changed;
+            break;
+        case S_WHILE:
+            changed = redirect_expr(stmt->value.w.expr, caller, c, clone) || changed;
+            changed = redirect_block(&stmt->value.w.stmts, caller, c, clone) || changed;
+            break;
+        }
+    }
+
+    return changed;
+}
+
+static void index_functions(void) {
+    clear(&functions);
+    for (size_t i = 0; i < program->funcs.len; i++) {
+        Index fn = {.key = program->funcs.items[i].decl.name, .index = i};
+        insert(&functions, fn);
+    }
+}
+
+// The clone takes the constant parameter as a local initialized to the constant, so the usual
+// passes fold it through the body even if the body assigns to it. It goes straight after the
+// original, before any of the callers that can use it.
+static Atom clone_function(const Candidate *c) {
+    Function orig = program->funcs.items[c->fn];
+    Function clone = {.decl = orig.decl};
+    clone.decl.name = fresh_name(orig.decl.name, "spec", ++cloning.clones);
+
+    for (size_t i = 0; i < orig.args.len; i++) {
+        if (i != c->param) {
+            append(&clone.args, orig.args.items[i]);
+        }
+    }
+
+    Statement param = {.kind = S_DEFINITION};
+    param.value.d.decl = orig.args.items[c->param];
+    Expr value = {.kind = E_VALUE};
+    value.value.v = (ValueExpr){.kind = V_NUMBER, .value.num = c->value};
+    param.value.d.expr = push_expr(value);
+
+    size_t mark = inline_stack.len;
+    append(&inline_stack, param);
+    clear(&renames);
+    inline_site++;
+    clone_returns = true;
+    clone_statements(&orig.stmts);
+    clone_returns = false;
+
+    clone.stmts = (Block){.start = program->stmts.len, .len = inline_stack.len - mark};
+    append_n(&program->stmts, &inline_stack.items[mark], clone.stmts.len);
+    inline_stack.len = mark;
+
+    append(&program->funcs, clone);
+    Function *funcs = program->funcs.items;
+    memmove(&funcs[c->fn + 2], &funcs[c->fn + 1],
+            (program->funcs.len - c->fn - 2) * sizeof(Function));
+    funcs[c->fn + 1] = clone;
+
+    return clone.decl.name;
+}
+
+// Clone the function most often called with the same constant argument, until the budget of
+// clones is spent or no constant is passed often enough
+static void specialize_program(void) {
+    while (cloning.clones < cloning.budget) {
+        candidates.len = 0;
+        for (size_t i = 0; i < program->funcs.len; i++) {
+            count_block(&program->funcs.items[i].stmts, i);
+        }
+
+        const Candidate *best = nullptr;
+        for (size_t i = 0; i < candidates.len; i++) {
+            if (best == nullptr || candidates.items[i].calls > best->calls) {
+                best = &candidates.items[i];
+            }
+        }
+        if (best == nullptr || best->calls < CLONE_MIN_CALLS) {
+            break;
+        }
+
+        Candidate c = *best;
+        Atom clone = clone_function(&c);
+        index_functions();
+        find_evaluable();
+
+        // The clone's own calls with the same constant become recursive calls of the clone. The
+        // constant only reaches the calls that pass the parameter on once the clone has been
+        // optimized, so it is redirected after that.
+        for (size_t i = c.fn + 1; i < program->funcs.len; i++) {
+            Function *func = &program->funcs.items[i];
+            if (i == c.fn + 1) {
+                optimize_function(program, func);
+            }
+            if (redirect_block(&func->stmts, i, &c, clone)) {
+                optimize_function(program, func);
+            }
+        }
+    }
+}
+
+void opt_program(Program *prg) {
+    program = prg;
+
+    index_functions();
+    find_evaluable();
+
+    for (size_t i = 0; i < prg->funcs.len; i++) {
+        optimize_function(prg, &prg->funcs.items[i]);
+    }
+
+    // Callees are inlined once they have been simplified, so their cost reflects what would be
+    // copied, and a caller that gained code is simplified again
+    if (inlining.threshold > 0) {
+        for (size_t i = 0; i < prg->funcs.len; i++) {
+            Function *func = &prg->funcs.items[i];
+            if (inline_function(prg, func)) {
+                optimize_function(prg, func);
+            }
+        }
+    }
+
+    if (cloning.budget > 0) {
+        specialize_program();
+    }
+
+    arrayfree(&candidates);
+    arrayfree(&evaluable);
+    arrayfree(&eval_vars);
+    arrayfree(&eval_args);
+    mapfree(&renames);
+    arrayfree(&inline_stack);
+    arrayfree(&clone_args);
+    mapfree(&bindings);
+    mapfree(&defined);
+    arrayfree(&scope);
+    arrayfree(&spelling);
+    mapfree(&locals);
+    mapfree(&stamps);
+    mapfree(&local_index);
+    mapfree(&functions);
+}
@@ -8,17 +8,16 @@
 #include "token.h"
 #include "util.h"
 
-#define panic_unexpected_token(t)                                                                  \
-    char *display;                                                                                 \
-    if (t == nullptr) {                                                                            \
+#define panic_unexpected_token(ts, t)                                                              \
+    if ((t)->kind == T_EOF) {                                                                      \
         fprintf(stderr, "unexpected eof\n");                                                       \
-    } else if (t->value.items != nullptr) {                                                        \
-        display = t->value.items;                                                                  \
-        int len = t->value.len;                                                                    \
-        fprintf(stderr, "%ld: unexpected token: %.*s\n", t->pos.line, len, display);               \
     } else {                                                                                       \
-        display = symbol_values[t->kind];                                                          \
-        fprintf(stderr, "%ld: unexpected token: %s\n", t->pos.line, display);                      \
+        size_t line = lexer_line((ts)->lexer, (t)->offset);                                        \
+        if ((t)->atom != A_NONE) {                                                                 \
+            fprintf(stderr, "%ld: unexpected token: %.*s\n", line, atom_fmt((t)->atom));           \
+        } else {                                                                                   \
+            fprintf(stderr, "%ld: unexpected token: %s\n", line, symbol_values[(t)->kind]);        \
+        }                                                                                          \
     }                                                                                              \
     exit(1);
 
@@ -26,31 +25,47 @@ static char *op_values[] = {[OP_ADD] = "+",  [OP_SUB] = "-",   [OP_MUL] = "*",
                             [OP_LT] = "<",   [OP_LE] = "<=",   [OP_GT] = ">",    [OP_GE] = ">=",
                             [OP_EQY] = "==", [OP_NEQY] = "!=", [OP_LAND] = "&&", [OP_LOR] = "||"};
 
-static Token *next_token(TokenIter *ts) {
-    Token *t = next(ts);
-    if (t == nullptr) {
-        panic_unexpected_token(t);
+// Statements of enclosing blocks, and arguments of enclosing calls, are held here until their list
+// is complete. Lists are then copied into the program's pools in one piece, so nested blocks and
+// calls never interleave with their parent's list.
+static Statements block_stack = {0};
+static ExprIds arg_stack = {0};
+
+static ExprId push_expr(Program *prg, Expr expr) {
+    append(&prg->exprs, expr);
+
+    return prg->exprs.len - 1;
+}
+
+static TokenKind peek_kind(TokenIter *ts) {
+    return token_peek_kind(ts, 0);
+}
+
+static Token next_token(TokenIter *ts) {
+    Token t = token_peek(ts, 0);
+    if (t.kind == T_EOF) {
+        panic_unexpected_token(ts, &t);
     }
+    ts->position++;
 
     return t;
 }
 
 static Token expect(TokenIter *ts, TokenKind want) {
-    Token *t = next_token(ts);
-    if (t->kind != want) {
-        panic_unexpected_token(t);
+    Token t = next_token(ts);
+    if (t.kind != want) {
+        panic_unexpected_token(ts, &t);
     }
 
-    return *t;
+    return t;
 }
 
 static bool check(TokenIter *ts, TokenKind want) {
-    Token *a = peek(ts);
-    if (a == nullptr || a->kind != want) {
+    if (peek_kind(ts) != want) {
         return false;
     }
 
-    next(ts);
+    ts->position++;
 
     return true;
 }
@@ -62,25 +77,26 @@ static bool checkn(TokenIter *ts, TokenKind start, ...) {
 
     va_start(args, start);
     for (TokenKind want = start; want != 0; want = va_arg(args, TokenKind)) {
-        Token *a = peek(ts);
-        if (a == nullptr || a->kind != want) {
+        if (peek_kind(ts) != want) {
             ts->position = position;
+            va_end(args);
             return false;
         }
 
-        next(ts);
+        ts->position++;
     }
+    va_end(args);
 
     return true;
 }
 
-static bool checkkw(TokenIter *ts, const char *kw) {
-    Token *a = peek(ts);
-    if (a == nullptr || a->kind != T_KEYWORD || strcmp(kw, a->value.items) != 0) {
+static bool checkkw(TokenIter *ts, Atom kw) {
+    Token t = token_peek(ts, 0);
+    if (t.kind != T_KEYWORD || t.atom != kw) {
         return false;
     }
 
-    next(ts);
+    ts->position++;
 
     return true;
 }
@@ -88,19 +104,23 @@ static bool checkkw(TokenIter *ts, const char *kw) {
 Program parse_program(TokenIter *ts) {
     Program prg = {0};
 
-    prg.funcs = parse_functions(ts);
+    prg.funcs = parse_functions(&prg, ts);
+
+    shrink_to_fit(&prg.exprs);
+    shrink_to_fit(&prg.stmts);
+    shrink_to_fit(&prg.lists);
 
     return prg;
 }
 
-Function parse_function(TokenIter *ts) {
+Function parse_function(Program *prg, TokenIter *ts) {
     Function func = {0};
 
     func.decl = parse_declaration(ts);
 
     expect(ts, T_LPAREN);
     if (check(ts, T_RPAREN)) {
-        func.stmts = parse_statements(ts);
+        func.stmts = parse_statements(prg, ts);
         return func;
     }
 
@@ -110,23 +130,23 @@ Function parse_function(TokenIter *ts) {
     } while (check(ts, T_COMMA));
     expect(ts, T_RPAREN);
 
-    func.stmts = parse_statements(ts);
+    func.stmts = parse_statements(prg, ts);
 
     return func;
 }
 
-Functions parse_functions(TokenIter *ts) {
+Functions parse_functions(Program *prg, TokenIter *ts) {
     Functions funcs = {0};
 
     do {
-        Function func = parse_function(ts);
+        Function func = parse_function(prg, ts);
         append(&funcs, func);
-    } while (peek(ts) != nullptr);
+    } while (peek_kind(ts) != T_EOF);
 
     return funcs;
 }
 
-Statement parse_statement(TokenIter *ts, bool *matched) {
+Statement parse_statement(Program *prg, TokenIter *ts, bool *matched) {
     Statement stmt = {0};
     *matched = true;
 
@@ -138,7 +158,7 @@ Statement parse_statement(TokenIter *ts, bool *matched) {
         DefinitionStatement *def = &stmt.value.d;
         def->decl = parse_declaration(ts);
         expect(ts, T_EQUAL);
-        def->expr = parse_expr(ts, 0);
+        def->expr = parse_expr(prg, ts, 0);
 
         expect(ts, T_SEMICOLON);
     } else if (checkn(ts, T_IDENT, T_EQUAL, 0)) {
@@ -148,36 +168,37 @@ Statement parse_statement(TokenIter *ts, bool *matched) {
 
         AssignStatement *asn = &stmt.value.a;
         Token id = expect(ts, T_IDENT);
-        asn->name = id.value;
+        asn->name = id.atom;
         expect(ts, T_EQUAL);
-        asn->expr = parse_expr(ts, 0);
+        asn->expr = parse_expr(prg, ts, 0);
 
         expect(ts, T_SEMICOLON);
-    } else if (checkkw(ts, "if")) {
+    } else if (checkkw(ts, A_IF)) {
         stmt.kind = S_IF;
 
         IfStatement *ifs = &stmt.value.i;
-        ifs->expr = parse_expr(ts, 0);
-        ifs->stmts = parse_statements(ts);
-    } else if (checkkw(ts, "while")) {
+        ifs->expr = parse_expr(prg, ts, 0);
+        ifs->stmts = parse_statements(prg, ts);
+    } else if (checkkw(ts, A_WHILE)) {
         stmt.kind = S_WHILE;
 
         WhileStatement *ws = &stmt.value.w;
-        ws->expr = parse_expr(ts, 0);
-        ws->stmts = parse_statements(ts);
-    } else if (checkkw(ts, "return")) {
+        ws->expr = parse_expr(prg, ts, 0);
+        ws->stmts = parse_statements(prg, ts);
+    } else if (checkkw(ts, A_RETURN)) {
         stmt.kind = S_RETURN;
 
         ReturnStatement *ret = &stmt.value.r;
+        ret->expr = NO_EXPR;
 
         if (!check(ts, T_SEMICOLON)) {
-            ret->expr = box(parse_expr(ts, 0));
+            ret->expr = parse_expr(prg, ts, 0);
             expect(ts, T_SEMICOLON);
         }
     } else {
-        Token *t = peek(ts);
-        if (t == nullptr || (t->kind != T_IDENT && t->kind != T_LPAREN && t->kind != T_STRING &&
-                             t->kind != T_NUMBER)) { // parse_prefix
+        TokenKind kind = peek_kind(ts);
+        if (kind != T_IDENT && kind != T_LPAREN && kind != T_STRING &&
+            kind != T_NUMBER) { // parse_prefix
             *matched = false;
             return stmt;
         }
@@ -185,7 +206,7 @@ Statement parse_statement(TokenIter *ts, bool *matched) {
         stmt.kind = S_EXPR;
 
         ExprStatement *as = &stmt.value.e;
-        as->expr = parse_expr(ts, 0);
+        as->expr = parse_expr(prg, ts, 0);
 
         expect(ts, T_SEMICOLON);
     }
@@ -193,28 +214,32 @@ Statement parse_statement(TokenIter *ts, bool *matched) {
     return stmt;
 }
 
-Statements parse_statements(TokenIter *ts) {
-    Statements stmts = {0};
+Block parse_statements(Program *prg, TokenIter *ts) {
+    size_t mark = block_stack.len;
 
     expect(ts, T_LBRACE);
     while (true) {
         bool matched = false;
-        Statement stmt = parse_statement(ts, &matched);
+        Statement stmt = parse_statement(prg, ts, &matched);
         if (!matched) {
             break;
         }
 
-        append(&stmts, stmt);
+        append(&block_stack, stmt);
     }
     expect(ts, T_RBRACE);
 
-    return stmts;
+    Block block = {.start = prg->stmts.len, .len = block_stack.len - mark};
+    append_n(&prg->stmts, &block_stack.items[mark], block.len);
+    block_stack.len = mark;
+
+    return block;
 }
 
 Type parse_type(TokenIter *ts) {
     Type type = {0};
 
-    type.name = expect(ts, T_IDENT).value;
+    type.name = expect(ts, T_IDENT).atom;
     type.pointer = check(ts, T_STAR);
 
     return type;
@@ -224,7 +249,7 @@ Declaration parse_declaration(TokenIter *ts) {
     Declaration decl = {0};
 
     decl.type = parse_type(ts);
-    decl.name = expect(ts, T_IDENT).value;
+    decl.name = expect(ts, T_IDENT).atom;
 
     return decl;
 }
@@ -257,17 +282,12 @@ int next_prec(BinaryOp op) {
     return 0;
 }
 
-Expr parse_expr(TokenIter *ts, int prec) {
-    Expr expr = parse_prefix(ts);
+ExprId parse_expr(Program *prg, TokenIter *ts, int prec) {
+    ExprId expr = parse_prefix(prg, ts);
 
     while (true) {
-        Token *t = peek(ts);
-        if (t == nullptr) {
-            break;
-        }
-
         BinaryOp op;
-        switch (t->kind) {
+        switch (peek_kind(ts)) {
         case T_PLUS:
             op = OP_ADD;
             break;
@@ -312,97 +332,104 @@ Expr parse_expr(TokenIter *ts, int prec) {
         if (prec >= nprec) {
             break;
         }
-        next(ts);
+        ts->position++;
 
-        Expr rhs = parse_expr(ts, nprec);
-        expr = binop(expr, op, rhs);
+        ExprId rhs = parse_expr(prg, ts, nprec);
+        expr = binop(prg, expr, op, rhs);
     }
 
     return expr;
 }
 
-Expr parse_prefix(TokenIter *ts) {
-    Token *t = next_token(ts);
+ExprId parse_prefix(Program *prg, TokenIter *ts) {
+    Token t = next_token(ts);
 
     ValueExpr *value;
     Expr expr = {0};
-    switch (t->kind) {
+    switch (t.kind) {
     case T_NUMBER:
         expr.kind = E_VALUE;
         value = &expr.value.v;
         value->kind = V_NUMBER;
-        value->value.num = strtol(t->value.items, nullptr, 10);
+        StringView text = atom_view(t.atom);
+        value->value.num = stringtol(&text);
         break;
     case T_STRING:
         expr.kind = E_VALUE;
         value = &expr.value.v;
         value->kind = V_STRING;
-        value->value.str = t->value;
+        value->value.str = atom_view(t.atom);
         break;
     case T_CHAR:
         expr.kind = E_VALUE;
         value = &expr.value.v;
         value->kind = V_CHAR;
-        value->value.ch = t->value;
+        value->value.ch = atom_view(t.atom);
         break;
     case T_LPAREN:
-        expr = parse_expr(ts, 0);
+        ExprId inner = parse_expr(prg, ts, 0);
         expect(ts, T_RPAREN);
-        break;
+        return inner;
     case T_IDENT:
-        Token *n = peek(ts);
-        if (n == nullptr || n->kind != T_LPAREN) {
+        if (peek_kind(ts) != T_LPAREN) {
             expr.kind = E_IDENT;
             IdentExpr *id = &expr.value.id;
-            id->name = t->value;
+            id->name = t.atom;
         } else {
             expr.kind = E_CALL;
             CallExpr *c = &expr.value.c;
-            c->name = t->value;
+            c->name = t.atom;
 
             expect(ts, T_LPAREN);
             if (check(ts, T_RPAREN)) {
-                return expr;
+                return push_expr(prg, expr);
             }
 
+            size_t mark = arg_stack.len;
             do {
-                Expr expr = parse_expr(ts, 0);
-                append(&c->args, expr);
+                ExprId arg = parse_expr(prg, ts, 0);
+                append(&arg_stack, arg);
             } while (check(ts, T_COMMA));
             expect(ts, T_RPAREN);
+
+            c->args.start = prg->lists.len;
+            c->args.len = arg_stack.len - mark;
+            append_n(&prg->lists, &arg_stack.items[mark], c->args.len);
+            arg_stack.len = mark;
         }
 
         break;
     default:
-        panic_unexpected_token(t);
+        panic_unexpected_token(ts, &t);
     }
 
-    return expr;
+    return push_expr(prg, expr);
 }
 
-Expr binop(Expr lhs, BinaryOp op, Expr rhs) {
+ExprId binop(Program *prg, ExprId lhs, BinaryOp op, ExprId rhs) {
     Expr expr = {0};
     expr.kind = E_BINARY_OP;
     BinaryOpExpr *bop = &expr.value.b;
-    bop->left = box(lhs);
+    bop->left = lhs;
     bop->op = op;
-    bop->right = box(rhs);
+    bop->right = rhs;
 
-    return expr;
+    return push_expr(prg, expr);
 }
 
-void print_expr(const Expr *expr) {
-    if (expr == nullptr) {
+void print_expr(const Program *prg, ExprId id) {
+    if (id == NO_EXPR) {
         return;
     }
 
+    const Expr *expr = expr_at(prg, id);
     switch (expr->kind) {
     case E_BINARY_OP:
         BinaryOpExpr b = expr->value.b;
         printf("(%s ", op_values[b.op]);
-        print_expr(b.left);
+        print_expr(prg, b.left);
         printf(" ");
-        print_expr(b.right);
+        print_expr(prg, b.right);
         printf(")");
 
         break;
@@ -423,16 +450,16 @@ void print_expr(const Expr *expr) {
         break;
     case E_IDENT:
         IdentExpr id = expr->value.id;
-        printf("%.*s", (int)id.name.len, id.name.items);
+        printf("%.*s", atom_fmt(id.name));
 
         break;
     case E_CALL:
         char *sep = "";
         CallExpr c = expr->value.c;
-        printf("%.*s(", (int)c.name.len, c.name.items);
+        printf("%.*s(", atom_fmt(c.name));
         for (size_t i = 0; i < c.args.len; i++) {
             printf("%s", sep);
-            print_expr(&c.args.items[i]);
+            print_expr(prg, list_at(prg, &c.args, i));
             sep = ", ";
         }
         printf(")");
@@ -441,19 +468,19 @@ void print_expr(const Expr *expr) {
     }
 }
 
-void print_statements(const Statements *stmts, int tab) {
+void print_statements(const Program *prg, const Block *stmts, int tab) {
     if (stmts == nullptr) {
         return;
     }
 
     for (size_t i = 0; i < stmts->len; i++) {
         printf("%*s", tab * 4, "");
-        print_statement(&stmts->items[i], tab);
+        print_statement(prg, stmt_at(prg, stmts, i), tab);
         printf("\n");
     }
 }
 
-void print_statement(const Statement *stmt, int tab) {
+void print_statement(const Program *prg, const Statement *stmt, int tab) {
     if (stmt == nullptr) {
         return;
     }
@@ -461,7 +488,7 @@ void print_statement(const Statement *stmt, int tab) {
     switch (stmt->kind) {
     case S_DEFINITION:
         DefinitionStatement def = stmt->value.d;
-        print_expr(&def.expr);
+        print_expr(prg, def.expr);
         break;
     case S_ASSIGN:
         // AssignStatement asn = stmt->value.a;
@@ -469,26 +496,26 @@ void print_statement(const Statement *stmt, int tab) {
         break;
     case S_EXPR:
         ExprStatement e = stmt->value.e;
-        print_expr(&e.expr);
+        print_expr(prg, e.expr);
         break;
     case S_IF:
         IfStatement ifs = stmt->value.i;
         printf("if ");
-        print_expr(&ifs.expr);
+        print_expr(prg, ifs.expr);
         printf("\n");
-        print_statements(&ifs.stmts, tab + 1);
+        print_statements(prg, &ifs.stmts, tab + 1);
         break;
     case S_WHILE:
         WhileStatement ws = stmt->value.w;
         printf("while ");
-        print_expr(&ws.expr);
+        print_expr(prg, ws.expr);
         printf("\n");
-        print_statements(&ws.stmts, tab + 1);
+        print_statements(prg, &ws.stmts, tab + 1);
         break;
     case S_RETURN:
         ReturnStatement ret = stmt->value.r;
         printf("return(");
-        print_expr(ret.expr);
+        print_expr(prg, ret.expr);
         printf(")");
     }
 }
@@ -1,57 +1,124 @@
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "array.h"
 #include "str.h"
 #include "util.h"
 
+#define READ_CHUNK 65536
+
+// Files that can't be mapped (pipes, character devices, empty files) are read in chunks instead
+static String string_from_reads(int fd) {
+    String s = {0};
+
+    ssize_t n;
+    do {
+        reserve(&s, READ_CHUNK);
+        n = read(fd, &s.items[s.len], s.cap - s.len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            fprintf(stderr, "read: %s", strerror(errno));
+            exit(1);
+        }
+
+        s.len += n;
+    } while (n != 0);
+
+    return s;
+}
+
 String string_from_file(int fd) {
-    off_t size = lseek(fd, 0, SEEK_END);
-    if (size == -1) {
-        fprintf(stderr, "lseek: %s", strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        fprintf(stderr, "fstat: %s", strerror(errno));
         exit(1);
     }
 
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        fprintf(stderr, "lseek: %s", strerror(errno));
-        exit(1);
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+        return string_from_reads(fd);
     }
 
-    char *buf = malloc(size);
-    char *ptr = buf;
-
-    ssize_t n;
-    while ((n = read(fd, ptr, size)) > 0) {
-        ptr = buf;
-        ptr += n;
-    }
-    if (n == -1) {
-        fprintf(stderr, "read: %s", strerror(errno));
-        exit(1);
+    char *buf = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED) {
+        return string_from_reads(fd);
     }
 
+    // The lexer makes a single forward pass over the file
+    madvise(buf, st.st_size, MADV_SEQUENTIAL);
+
     String s = {
         .items = buf,
-        .cap = size,
-        .len = size,
+        .cap = 0,
+        .len = st.st_size,
     };
 
     return s;
 }
 
+void string_close(String *s) {
+    if (s->cap == 0 && s->len != 0) {
+        munmap(s->items, s->len);
+        s->items = nullptr;
+        s->len = 0;
+    } else {
+        arrayfree(s);
+    }
+}
+
 String string_from_cstr(char *s) {
     String t = {0};
+    append_n(&t, s, strlen(s));
+
+    return t;
+}
 
-    char c;
-    while ((c = *s++)) {
-        append(&t, c);
+StringView string_view(const String *s, size_t start, size_t end) {
+    StringView v = {.items = &s->items[start], .len = end - start};
+
+    return v;
+}
+
+int stringcmp(const StringView *s, const StringView *t) {
+    int cmp = memcmp(s->items, t->items, min(s->len, t->len));
+    if (cmp != 0 || s->len == t->len) {
+        return cmp;
     }
 
-    return t;
+    return s->len < t->len ? -1 : 1;
 }
 
-int stringcmp(const String *s, const String *t) {
-    return strncmp(s->items, t->items, min(s->len, t->len));
+int stringcmp_cstr(const StringView *s, const char *t) {
+    StringView v = {.items = t, .len = strlen(t)};
+
+    return stringcmp(s, &v);
+}
+
+// Views are not null terminated, so strtol would read past the end of the token. Out of range
+// values saturate as they do with strtol.
+long stringtol(const StringView *s) {
+    size_t i = 0;
+    bool negative = false;
+    if (s->len > 0 && s->items[0] == '-') {
+        negative = true;
+        i++;
+    }
+
+    // Accumulated with the literal's sign so LONG_MIN is reachable
+    long n = 0;
+    for (; i < s->len && s->items[i] >= '0' && s->items[i] <= '9'; i++) {
+        int d = s->items[i] - '0';
+        if (negative ? n < (LONG_MIN + d) / 10 : n > (LONG_MAX - d) / 10) {
+            return negative ? LONG_MIN : LONG_MAX;
+        }
+        n = negative ? n * 10 - d : n * 10 + d;
+    }
+
+    return n;
 }
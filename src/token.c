@@ -1,5 +1,8 @@
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "array.h"
 #include "string.h"
@@ -8,8 +11,9 @@
 #define panic_unexpected_symbol(c)                                                                 \
     if (c == nullptr) {                                                                            \
         fprintf(stderr, "unexpected eof\n");                                                       \
+    } else {                                                                                       \
+        fprintf(stderr, "unexpected symbol: %c\n", *c);                                            \
     }                                                                                              \
-    fprintf(stderr, "unexpected symbol: %c\n", *c);                                                \
     exit(1);
 
 TokenKind symbol_tokens[256] = {
@@ -25,246 +29,550 @@ char *symbol_values[256] = {
     [T_RBRACK] = "]",    [T_EQUALITY] = "==", [T_NEQUALITY] = "!=", [T_LAND] = "&&",
     [T_LOR] = "||"};
 
-char *keywords[] = {"if", "else", "while", "for", "return", "null"};
+// Character classes, looked up once per byte instead of going through a chain of predicates
+enum { C_SPACE = 1, C_NEWLINE = 2, C_ALPHA = 4, C_DIGIT = 8 };
+
+static const uint8_t char_class[256] = {
+    [' '] = C_SPACE, ['\t'] = C_SPACE, ['\n'] = C_NEWLINE,
+    ['0'] = C_DIGIT, ['1'] = C_DIGIT, ['2'] = C_DIGIT, ['3'] = C_DIGIT, ['4'] = C_DIGIT,
+    ['5'] = C_DIGIT, ['6'] = C_DIGIT, ['7'] = C_DIGIT, ['8'] = C_DIGIT, ['9'] = C_DIGIT,
+    ['A'] = C_ALPHA, ['B'] = C_ALPHA, ['C'] = C_ALPHA, ['D'] = C_ALPHA, ['E'] = C_ALPHA,
+    ['F'] = C_ALPHA, ['G'] = C_ALPHA, ['H'] = C_ALPHA, ['I'] = C_ALPHA, ['J'] = C_ALPHA,
+    ['K'] = C_ALPHA, ['L'] = C_ALPHA, ['M'] = C_ALPHA, ['N'] = C_ALPHA, ['O'] = C_ALPHA,
+    ['P'] = C_ALPHA, ['Q'] = C_ALPHA, ['R'] = C_ALPHA, ['S'] = C_ALPHA, ['T'] = C_ALPHA,
+    ['U'] = C_ALPHA, ['V'] = C_ALPHA, ['W'] = C_ALPHA, ['X'] = C_ALPHA, ['Y'] = C_ALPHA,
+    ['Z'] = C_ALPHA, ['a'] = C_ALPHA, ['b'] = C_ALPHA, ['c'] = C_ALPHA, ['d'] = C_ALPHA,
+    ['e'] = C_ALPHA, ['f'] = C_ALPHA, ['g'] = C_ALPHA, ['h'] = C_ALPHA, ['i'] = C_ALPHA,
+    ['j'] = C_ALPHA, ['k'] = C_ALPHA, ['l'] = C_ALPHA, ['m'] = C_ALPHA, ['n'] = C_ALPHA,
+    ['o'] = C_ALPHA, ['p'] = C_ALPHA, ['q'] = C_ALPHA, ['r'] = C_ALPHA, ['s'] = C_ALPHA,
+    ['t'] = C_ALPHA, ['u'] = C_ALPHA, ['v'] = C_ALPHA, ['w'] = C_ALPHA, ['x'] = C_ALPHA,
+    ['y'] = C_ALPHA, ['z'] = C_ALPHA};
+
+#define is_class(c, class) (char_class[(unsigned char)(c)] & (class))
+
+// Scanners return the offset of the first byte in s[pos:len] outside a class. The SIMD versions
+// classify 16 or 32 bytes at a time and finish the tail with the table.
+
+typedef size_t Scanner(const char *s, size_t pos, size_t len);
+
+typedef struct {
+    Scanner *space;
+    Scanner *ident;
+    Scanner *digits;
+} Scanners;
+
+static inline size_t scan_scalar(const char *s, size_t pos, size_t len, uint8_t class) {
+    while (pos < len && is_class(s[pos], class)) {
+        pos++;
+    }
 
-static int isnotdoublequote(char c) {
-    return c != '"';
+    return pos;
 }
 
-static int isalphabetic(char c) {
-    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+static size_t scan_space_scalar(const char *s, size_t pos, size_t len) {
+    return scan_scalar(s, pos, len, C_SPACE);
 }
 
-static int isnumeric(char c) {
-    return c >= '0' && c <= '9';
+static size_t scan_ident_scalar(const char *s, size_t pos, size_t len) {
+    return scan_scalar(s, pos, len, C_ALPHA | C_DIGIT);
 }
 
-static int isalphanumeric(char c) {
-    return isalphabetic(c) || isnumeric(c);
+static size_t scan_digits_scalar(const char *s, size_t pos, size_t len) {
+    return scan_scalar(s, pos, len, C_DIGIT);
 }
 
-static int isnewline(char c) {
-    return c == '\n';
+static Scanners scanners = {
+    .space = scan_space_scalar, .ident = scan_ident_scalar, .digits = scan_digits_scalar};
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// A byte is in [lo, lo + n] when the wrapped difference saturates to zero after subtracting n
+#define SIMD_SCANNER(isa, vec, width, load, set1, vor, cmpeq, subs, sub, movemask)                 \
+    __attribute__((target(#isa))) static inline vec in_class_##isa(vec v, uint8_t class) {         \
+        vec zero = set1(0);                                                                        \
+        vec m = zero;                                                                              \
+        if (class & C_SPACE) {                                                                     \
+            m = vor(m, vor(cmpeq(v, set1(' ')), cmpeq(v, set1('\t'))));                            \
+        }                                                                                          \
+        if (class & C_DIGIT) {                                                                     \
+            m = vor(m, cmpeq(subs(sub(v, set1('0')), set1(9)), zero));                             \
+        }                                                                                          \
+        if (class & C_ALPHA) {                                                                     \
+            vec lower = vor(v, set1(0x20));                                                        \
+            m = vor(m, cmpeq(subs(sub(lower, set1('a')), set1(25)), zero));                        \
+        }                                                                                          \
+        return m;                                                                                  \
+    }                                                                                              \
+                                                                                                   \
+    __attribute__((target(#isa))) static inline size_t scan_##isa(const char *s, size_t pos,       \
+                                                                  size_t len, uint8_t class) {     \
+        for (; pos + width <= len; pos += width) {                                                 \
+            vec v = load((const vec *)&s[pos]);                                                    \
+            uint32_t outside = ~(uint32_t)movemask(in_class_##isa(v, class));                      \
+            if (width < 32) {                                                                      \
+                outside &= (1u << (width % 32)) - 1;                                               \
+            }                                                                                      \
+            if (outside != 0) {                                                                    \
+                return pos + __builtin_ctz(outside);                                               \
+            }                                                                                      \
+        }                                                                                          \
+                                                                                                   \
+        return scan_scalar(s, pos, len, class);                                                    \
+    }                                                                                              \
+                                                                                                   \
+    __attribute__((target(#isa))) static size_t scan_space_##isa(const char *s, size_t pos,        \
+                                                                 size_t len) {                     \
+        return scan_##isa(s, pos, len, C_SPACE);                                                   \
+    }                                                                                              \
+                                                                                                   \
+    __attribute__((target(#isa))) static size_t scan_ident_##isa(const char *s, size_t pos,        \
+                                                                 size_t len) {                     \
+        return scan_##isa(s, pos, len, C_ALPHA | C_DIGIT);                                         \
+    }                                                                                              \
+                                                                                                   \
+    __attribute__((target(#isa))) static size_t scan_digits_##isa(const char *s, size_t pos,       \
+                                                                  size_t len) {                    \
+        return scan_##isa(s, pos, len, C_DIGIT);                                                   \
+    }
+
+SIMD_SCANNER(sse2, __m128i, 16, _mm_loadu_si128, _mm_set1_epi8, _mm_or_si128, _mm_cmpeq_epi8,
+             _mm_subs_epu8, _mm_sub_epi8, _mm_movemask_epi8)
+SIMD_SCANNER(avx2, __m256i, 32, _mm256_loadu_si256, _mm256_set1_epi8, _mm256_or_si256,
+             _mm256_cmpeq_epi8, _mm256_subs_epu8, _mm256_sub_epi8, _mm256_movemask_epi8)
+#endif
+
+static void pick_scanners(void) {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        scanners = (Scanners){
+            .space = scan_space_avx2, .ident = scan_ident_avx2, .digits = scan_digits_avx2};
+    } else {
+        scanners = (Scanners){
+            .space = scan_space_sse2, .ident = scan_ident_sse2, .digits = scan_digits_sse2};
+    }
+#endif
 }
 
-static int isnotnewline(char c) {
-    return c != '\n';
+// Streaming lexers read in chunks of this size, and compact the window once this many bytes
+// before the current token have been consumed
+#define LEX_CHUNK 65536
+
+Lexer lexer_from_string(const String *s) {
+    pick_scanners();
+    Lexer l = {.buf = *s, .fd = -1, .eof = true};
+
+    return l;
 }
 
-static int iswhitespace(char c) {
-    return c == ' ' || c == '\t';
+Lexer lexer_from_fd(int fd) {
+    pick_scanners();
+    Lexer l = {.fd = fd};
+
+    return l;
 }
 
-static void extend_while(String *s, CharIter *chars, int p(char)) {
-    char *c;
-    while ((c = peek(chars))) {
-        if (!p(*c)) {
-            break;
-        }
+// Read the next chunk into the window, returns false at the end of input
+static bool lexer_fill(Lexer *l) {
+    if (l->eof) {
+        return false;
+    }
 
-        append(s, *c);
+    reserve(&l->buf, LEX_CHUNK);
 
-        if (++chars->position == chars->array.len) {
-            break;
-        }
+    ssize_t n;
+    do {
+        n = read(l->fd, &l->buf.items[l->buf.len], l->buf.cap - l->buf.len);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1) {
+        fprintf(stderr, "read: %s", strerror(errno));
+        exit(1);
+    }
+    if (n == 0) {
+        l->eof = true;
+        return false;
     }
+
+    l->buf.len += n;
+
+    return true;
 }
 
-static void consume_while(CharIter *chars, int p(char)) {
-    char *c;
-    while ((c = peek(chars))) {
-        if (!p(*c)) {
-            break;
-        }
+// Drop the bytes before the current position. Only safe between tokens, since the token being
+// lexed refers to the window by offset.
+static void lexer_compact(Lexer *l) {
+    if (l->fd == -1 || l->position < LEX_CHUNK) {
+        return;
+    }
 
-        if (++chars->position == chars->array.len) {
-            break;
-        }
+    size_t rest = l->buf.len - l->position;
+    memmove(l->buf.items, &l->buf.items[l->position], rest);
+    l->buf.len = rest;
+    l->offset += l->position;
+    l->position = 0;
+}
+
+static char *lex_peek(Lexer *l) {
+    if (l->position == l->buf.len && !lexer_fill(l)) {
+        return nullptr;
     }
+
+    return &l->buf.items[l->position];
 }
 
-Tokens tokenise(const String *s) {
-    Tokens toks = {0};
-    size_t line = 1;
+static char *lex_next(Lexer *l) {
+    char *c = lex_peek(l);
+    if (c != nullptr) {
+        l->position++;
+    }
 
-    CharIter chars = {0};
-    chars.array = *s;
+    return c;
+}
 
-    char *c;
-    while ((c = peek(&chars))) {
-        Token tok = {0};
+// Skip a run of bytes matched by scan, refilling the window while the run reaches its end
+static void consume_while(Lexer *l, Scanner *scan) {
+    do {
+        l->position = scan(l->buf.items, l->position, l->buf.len);
+    } while (l->position == l->buf.len && lexer_fill(l));
+}
 
-        if (iswhitespace(*c)) {
-            next(&chars);
+// Skip up to, but not past, the next occurrence of c
+static void consume_until(Lexer *l, char c) {
+    do {
+        const char *found = memchr(&l->buf.items[l->position], c, l->buf.len - l->position);
+        if (found != nullptr) {
+            l->position = found - l->buf.items;
+            return;
+        }
 
-            continue;
-        } else if (isnewline(*c)) {
-            next(&chars);
-            line++;
+        l->position = l->buf.len;
+    } while (lexer_fill(l));
+}
 
-            continue;
-        } else if (isalphabetic(*c)) {
-            String value = {0};
-            extend_while(&value, &chars, isalphanumeric);
+// The source is dropped as a stream is read, so line starts inside a literal are recorded when it
+// is lexed, the same ones lexer_line finds in a whole buffer
+static void record_lines(Lexer *l, size_t start, size_t end) {
+    if (l->fd == -1) {
+        return;
+    }
 
-            tok.kind = T_IDENT;
-            tok.value = value;
+    const char *last = &l->buf.items[end];
+    for (const char *c = &l->buf.items[start]; (c = memchr(c, '\n', last - c)) != nullptr;) {
+        c++;
+        append(&l->lines, l->offset + (c - l->buf.items));
+    }
+}
 
-            for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
-                if (strcmp(keywords[i], tok.value.items) == 0) {
-                    tok.kind = T_KEYWORD;
-                    break;
-                }
+bool lex_token(Lexer *l, Token *out) {
+    char *p;
+    while ((lexer_compact(l), p = lex_peek(l))) {
+        Token tok = {0};
+        char c = *p;
+        size_t tokstart = l->position;
+
+        if (is_class(c, C_SPACE)) {
+            consume_while(l, scanners.space);
+
+            continue;
+        } else if (c == '\n') {
+            lex_next(l);
+            if (l->fd != -1) {
+                append(&l->lines, l->offset + l->position);
             }
-        } else if (isnumeric(*c)) {
-            String value = {0};
-            extend_while(&value, &chars, isnumeric);
 
+            // Indentation almost always follows
+            consume_while(l, scanners.space);
+
+            continue;
+        } else if (is_class(c, C_ALPHA)) {
+            size_t start = l->position;
+            consume_while(l, scanners.ident);
+
+            StringView text = string_view(&l->buf, start, l->position);
+            tok.atom = intern(&text);
+            tok.kind = is_keyword(tok.atom) ? T_KEYWORD : T_IDENT;
+        } else if (is_class(c, C_DIGIT)) {
+            size_t start = l->position;
+            consume_while(l, scanners.digits);
+
+            StringView text = string_view(&l->buf, start, l->position);
             tok.kind = T_NUMBER;
-            tok.value = value;
-        } else if (*c == '/') {
-            next(&chars);
+            tok.atom = intern(&text);
+        } else if (c == '/') {
+            lex_next(l);
 
-            if (*(c = peek(&chars)) == '/') {
-                consume_while(&chars, isnotnewline);
+            char *n = lex_peek(l);
+            if (n != nullptr && *n == '/') {
+                consume_until(l, '\n');
                 continue;
             } else {
                 tok.kind = T_SLASH;
             }
-        } else if (*c == '-') {
-            next(&chars);
-
-            String value = string_from_cstr("-");
-            extend_while(&value, &chars, isnumeric);
+        } else if (c == '-') {
+            size_t start = l->position;
+            lex_next(l);
+            consume_while(l, scanners.digits);
 
-            if (value.len == 1) {
+            if (l->position - start == 1) {
                 tok.kind = T_MINUS;
             } else {
+                StringView text = string_view(&l->buf, start, l->position);
                 tok.kind = T_NUMBER;
-                tok.value = value;
+                tok.atom = intern(&text);
             }
-        } else if (*c == '"') {
-            next(&chars);
+        } else if (c == '"') {
+            lex_next(l);
 
-            String value = {0};
-            extend_while(&value, &chars, isnotdoublequote);
+            size_t start = l->position;
+            consume_until(l, '"');
+            size_t end = l->position;
 
-            char *n = next(&chars);
+            char *n = lex_next(l);
             if (n == nullptr || *n != '"') {
-                fprintf(stderr, "expected closing quote: %c\n", *c);
+                fprintf(stderr, "expected closing quote: %c\n", c);
                 exit(1);
             }
 
+            record_lines(l, start, end);
+            StringView text = string_view(&l->buf, start, end);
             tok.kind = T_STRING;
-            tok.value = value;
-        } else if (*c == '\'') {
-            next(&chars);
+            tok.atom = intern(&text);
+        } else if (c == '\'') {
+            lex_next(l);
 
-            String value = {0};
+            size_t start = l->position;
 
-            char *n = next(&chars);
+            char *n = lex_next(l);
             if (n == nullptr) {
                 panic_unexpected_symbol(n);
             }
-            append(&value, *n);
 
             if (*n == '\\') {
-                n = next(&chars);
+                n = lex_next(l);
                 if (n == nullptr) {
                     panic_unexpected_symbol(n);
                 }
-                append(&value, *n);
             }
 
-            n = next(&chars);
+            size_t end = l->position;
+
+            n = lex_next(l);
             if (n == nullptr || *n != '\'') {
-                fprintf(stderr, "expected closing quote: %c\n", *c);
+                fprintf(stderr, "expected closing quote: %c\n", c);
                 exit(1);
             }
 
+            record_lines(l, start, end);
+            StringView text = string_view(&l->buf, start, end);
             tok.kind = T_CHAR;
-            tok.value = value;
-        } else if (*c == '<') {
-            next(&chars);
+            tok.atom = intern(&text);
+        } else if (c == '<') {
+            lex_next(l);
             tok.kind = T_LT;
 
-            char *n = peek(&chars);
+            char *n = lex_peek(l);
             if (n != nullptr && *n == '=') {
-                next(&chars);
+                lex_next(l);
                 tok.kind = T_LE;
             }
-        } else if (*c == '>') {
-            next(&chars);
+        } else if (c == '>') {
+            lex_next(l);
             tok.kind = T_GT;
 
-            char *n = peek(&chars);
+            char *n = lex_peek(l);
             if (n != nullptr && *n == '=') {
-                next(&chars);
+                lex_next(l);
                 tok.kind = T_GE;
             }
-        } else if (*c == '&') {
-            next(&chars);
-            char *n = next(&chars);
+        } else if (c == '&') {
+            lex_next(l);
+            char *n = lex_next(l);
             if (n == nullptr || *n != '&') {
-                panic_unexpected_symbol(c);
+                panic_unexpected_symbol(n);
             }
 
             tok.kind = T_LAND;
-        } else if (*c == '|') {
-            next(&chars);
-            char *n = next(&chars);
+        } else if (c == '|') {
+            lex_next(l);
+            char *n = lex_next(l);
             if (n == nullptr || *n != '|') {
-                panic_unexpected_symbol(c);
+                panic_unexpected_symbol(n);
             }
 
             tok.kind = T_LOR;
-        } else if (*c == '!') {
-            next(&chars);
-            char *n = next(&chars);
+        } else if (c == '!') {
+            lex_next(l);
+            char *n = lex_next(l);
             if (n == nullptr || *n != '=') {
-                panic_unexpected_symbol(c);
+                panic_unexpected_symbol(n);
             }
 
             tok.kind = T_NEQUALITY;
-        } else if (*c == '=') {
-            next(&chars);
-            char *n = peek(&chars);
+        } else if (c == '=') {
+            lex_next(l);
+            char *n = lex_peek(l);
             if (n != nullptr && *n == '=') {
-                next(&chars);
+                lex_next(l);
                 tok.kind = T_EQUALITY;
             } else {
                 tok.kind = T_EQUAL;
             }
         } else {
-            next(&chars);
+            lex_next(l);
 
-            tok.kind = symbol_tokens[*c];
+            tok.kind = symbol_tokens[c];
             if (tok.kind == 0) {
-                panic_unexpected_symbol(c);
+                panic_unexpected_symbol(p);
             }
         }
 
-        tok.pos.line = line;
-        append(&toks, tok);
+        size_t offset = l->offset + tokstart;
+        if (offset > UINT32_MAX) {
+            fprintf(stderr, "input too large\n");
+            exit(1);
+        }
+
+        tok.offset = offset;
+        *out = tok;
+
+        return true;
+    }
+
+    return false;
+}
+
+static void put_token(Tokens *toks, size_t i, const Token *tok) {
+    toks->kinds[i] = tok->kind;
+    toks->offsets[i] = tok->offset;
+    toks->atoms[i] = tok->atom;
+}
+
+static void push_token(Tokens *toks, const Token *tok) {
+    if (toks->len == toks->cap) {
+        size_t cap = toks->cap;
+        toks->kinds = array_grow(toks->kinds, &cap, toks->len + 1, sizeof(toks->kinds[0]));
+        cap = toks->cap;
+        toks->offsets = array_grow(toks->offsets, &cap, toks->len + 1, sizeof(toks->offsets[0]));
+        cap = toks->cap;
+        toks->atoms = array_grow(toks->atoms, &cap, toks->len + 1, sizeof(toks->atoms[0]));
+        toks->cap = cap;
+    }
+
+    put_token(toks, toks->len++, tok);
+}
+
+// Lexes the whole input at once, for print_tokens. The parser pulls tokens through a TokenIter.
+Tokens tokenise(Lexer *l) {
+    Tokens toks = {0};
+
+    Token tok;
+    while (lex_token(l, &tok)) {
+        push_token(&toks, &tok);
     }
 
     return toks;
 }
 
-void print_tokens(const Tokens *tokens) {
+Token token_at(const Tokens *toks, size_t i) {
+    Token tok = {.kind = toks->kinds[i], .offset = toks->offsets[i], .atom = toks->atoms[i]};
+
+    return tok;
+}
+
+TokenIter token_iter(Lexer *l) {
+    TokenIter ts = {.lexer = l};
+
+    size_t cap = 0;
+    ts.ring.kinds = array_grow(nullptr, &cap, TOKEN_RING, sizeof(ts.ring.kinds[0]));
+    cap = 0;
+    ts.ring.offsets = array_grow(nullptr, &cap, TOKEN_RING, sizeof(ts.ring.offsets[0]));
+    cap = 0;
+    ts.ring.atoms = array_grow(nullptr, &cap, TOKEN_RING, sizeof(ts.ring.atoms[0]));
+    ts.ring.len = ts.ring.cap = TOKEN_RING;
+
+    return ts;
+}
+
+// The ring slot of the token `ahead` places past the current position, lexing up to it if it isn't
+// buffered yet. Past the end of the input this is the T_EOF token.
+static size_t ring_slot(TokenIter *ts, size_t ahead) {
+    size_t want = ts->position + ahead;
+    if (ts->position < ts->start || ahead >= TOKEN_RING) {
+        fprintf(stderr, "token lookahead outside of ring\n");
+        exit(1);
+    }
+
+    while (ts->end <= want && !ts->eof) {
+        if (ts->end - ts->start == TOKEN_RING) {
+            ts->start++;
+        }
+
+        Token tok;
+        if (!lex_token(ts->lexer, &tok)) {
+            Lexer *l = ts->lexer;
+            tok = (Token){.kind = T_EOF, .offset = l->offset + l->position};
+            ts->eof = true;
+        }
+        put_token(&ts->ring, ts->end & (TOKEN_RING - 1), &tok);
+        ts->end++;
+    }
+
+    if (want >= ts->end) {
+        want = ts->end - 1;
+    }
+
+    return want & (TOKEN_RING - 1);
+}
+
+Token token_peek(TokenIter *ts, size_t ahead) {
+    return token_at(&ts->ring, ring_slot(ts, ahead));
+}
+
+TokenKind token_peek_kind(TokenIter *ts, size_t ahead) {
+    return ts->ring.kinds[ring_slot(ts, ahead)];
+}
+
+size_t lexer_line(Lexer *l, uint32_t offset) {
+    if (l->fd == -1 && l->lines.len == 0) {
+        const char *start = l->buf.items;
+        const char *end = start + l->buf.len;
+        for (const char *c = start; (c = memchr(c, '\n', end - c)) != nullptr;) {
+            c++;
+            append(&l->lines, c - start);
+        }
+    }
+
+    // Count the line starts at or before offset
+    size_t lo = 0;
+    size_t hi = l->lines.len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (l->lines.items[mid] <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo + 1;
+}
+
+void print_tokens(Lexer *l, const Tokens *tokens) {
     if (tokens == nullptr) {
         return;
     }
 
     for (size_t i = 0; i < tokens->len; i++) {
-        Token t = tokens->items[i];
-        printf("line %ld: ", t.pos.line);
+        Token t = token_at(tokens, i);
+        printf("line %ld: ", lexer_line(l, t.offset));
         switch (t.kind) {
         case T_IDENT:
         case T_KEYWORD:
         case T_NUMBER:
         case T_STRING:
-            printf("%.*s\n", (int)t.value.len, t.value.items);
+        case T_CHAR:
+            printf("%.*s\n", atom_fmt(t.atom));
             break;
         case T_EOF:
             break;